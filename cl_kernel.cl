@@ -1,8 +1,21 @@
-__kernel void compute_adjacencies(__global const char *state, __global char *adj, int border_width, int width, int offset){
+//The board kernels below can be launched either 1D over width*height cells or 2D over (x, y), and the global size may be
+//padded up to a multiple of the work-group size. Returns false for padding work-items.
+bool cell_coords(int width, int height, int *x, int *y){
+	if (get_work_dim()==2){
+		*x = get_global_id(0); *y = get_global_id(1);
+		return *x<width && *y<height;
+	}
 	size_t dim = get_global_id(0);
-	size_t x = dim % width; size_t y = dim / width; //Get 
-	int max = get_global_size(0);
-	int height= max/width;
+	*x = dim % width; *y = dim / width;
+	return *y<height;
+}
+
+__kernel void compute_adjacencies(__global const char *state, __global char *adj, int border_width, int width, int height, int offset){
+	int x, y;
+	if (!cell_coords(width, height, &x, &y)){
+		return;
+	}
+	size_t dim = (size_t)y*width+x;
 	if (x<border_width || y<border_width || x>=width-border_width || y>= height-border_width){
 		adj[dim]=0;
 	}
@@ -10,13 +23,19 @@ __kernel void compute_adjacencies(__global const char *state, __global char *adj
 		adj[dim]+=state[dim+offset]&1;
 	}
 }
-__kernel void zero_adjacencies(__global char *adj){
-	size_t dim = get_global_id(0);
-	adj[dim]=0;
+__kernel void zero_adjacencies(__global char *adj, int width, int height){
+	int x, y;
+	if (cell_coords(width, height, &x, &y)){
+		adj[(size_t)y*width+x]=0;
+	}
 }
 
-__kernel void compute_state(__global const char *adj, __global char *state){
-	size_t i = get_global_id(0);
+__kernel void compute_state(__global const char *adj, __global char *state, int width, int height){
+	int x, y;
+	if (!cell_coords(width, height, &x, &y)){
+		return;
+	}
+	size_t i = (size_t)y*width+x;
 	if (state[i]==1){
 		state[i]=(adj[i]==2)|(adj[i]==3);
 	}
@@ -25,8 +44,86 @@ __kernel void compute_state(__global const char *adj, __global char *state){
 	}
 }
 
-__kernel void write_state_to_image(__global const char *state, __write_only image2d_t output, int width){
-	size_t index = get_global_id(0);
+//Activity heatmap: one counter per tile x tile square, bumped by HEAT_UNIT for every cell that changes and faded by
+//1/2^HEAT_DECAY_SHIFT each generation, so a tile with n changes a generation settles near n*HEAT_UNIT<<HEAT_DECAY_SHIFT.
+//HEAT_UNIT and HEAT_DECAY_SHIFT are passed with -D by the host (program_options in main.c), which reads the counts back.
+#define HEAT_FULL (64*HEAT_UNIT<<HEAT_DECAY_SHIFT) //Changes per generation drawn at full strength
+//Changes are summed per work-group in local memory first, so each group adds to a tile's counter once instead of once
+//per changed cell. The local table covers HEAT_GROUP_ROWS x HEAT_GROUP_COLS tiles from the group's top left changed tile,
+//which holds any 2D group and most 1D ones; cells past it add to the global counter directly.
+#define HEAT_GROUP_ROWS 4
+#define HEAT_GROUP_COLS 32
+__kernel void compute_state_heat(__global const char *adj, __global char *state, int width, int height, __global uint *heat, int tiles_x, int tile){
+	__local uint group_heat[HEAT_GROUP_ROWS*HEAT_GROUP_COLS];
+	__local int group_tx, group_ty;
+	size_t local_id = get_local_id(1)*get_local_size(0)+get_local_id(0);
+	size_t group_size = get_local_size(0)*get_local_size(1);
+	if (local_id==0){
+		group_tx=INT_MAX; group_ty=INT_MAX;
+	}
+	for (size_t s=local_id;s<HEAT_GROUP_ROWS*HEAT_GROUP_COLS;s+=group_size){
+		group_heat[s]=0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	int x, y;
+	bool changed=false; //Every work-item has to reach the barriers, so padding and walls only skip the update
+	if (cell_coords(width, height, &x, &y)){
+		size_t i = (size_t)y*width+x;
+		char old = state[i];
+		if (old!=2){
+			char next = old==1?(adj[i]==2)|(adj[i]==3):(adj[i]==3);
+			state[i]=next;
+			changed = next!=old;
+		}
+	}
+	int tx = changed?x/tile:0; int ty = changed?y/tile:0;
+	if (changed){
+		atomic_min(&group_tx, tx);
+		atomic_min(&group_ty, ty);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (changed){
+		int col = tx-group_tx; int row = ty-group_ty;
+		if (col<HEAT_GROUP_COLS && row<HEAT_GROUP_ROWS){
+			atomic_add(&group_heat[row*HEAT_GROUP_COLS+col], HEAT_UNIT);
+		}
+		else{
+			atomic_add(&heat[ty*tiles_x+tx], HEAT_UNIT);
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (size_t s=local_id;s<HEAT_GROUP_ROWS*HEAT_GROUP_COLS;s+=group_size){
+		if (group_heat[s]!=0){
+			atomic_add(&heat[(group_ty+(int)s/HEAT_GROUP_COLS)*tiles_x+group_tx+(int)s%HEAT_GROUP_COLS], group_heat[s]);
+		}
+	}
+}
+
+__kernel void decay_heat(__global uint *heat, int tiles){
+	int i = get_global_id(0);
+	if (i<tiles){
+		heat[i]-=(heat[i]+(1<<HEAT_DECAY_SHIFT)-1)>>HEAT_DECAY_SHIFT;
+	}
+}
+
+//Heat of the cell's tile as an overlay strength, 0 with the heatmap off (tiles_x 0)
+float heat_level(__global const uint *heat, int tiles_x, int tile, int x, int y){
+	if (tiles_x==0){
+		return 0.0f;
+	}
+	return sqrt(min((float)heat[(y/tile)*tiles_x+x/tile]/HEAT_FULL, 1.0f));
+}
+
+//The alpha channel carries the heatmap, which the fragment shader draws as a tint
+__kernel void write_state_to_image(__global const char *state, __write_only image2d_t output, int width, int height, __global const uint *heat, int tiles_x, int tile){
+	int x, y;
+	if (!cell_coords(width, height, &x, &y)){
+		return;
+	}
+	size_t index = (size_t)y*width+x;
 	//uint4 color;
 	float4 color;
 	if (state[index]==0){
@@ -41,17 +138,40 @@ __kernel void write_state_to_image(__global const char *state, __write_only imag
 		//color = (uint4)(0,0,255,255);
 		color=(float4)(0.0,0.0,1.0,1.0);
 	}
-	int2 coord = (int2)(index % width, index / width);
+	color.w = heat_level(heat, tiles_x, tile, x, y);
+	int2 coord = (int2)(x, y);
 	write_imagef(output, coord, color);
 }
 
+//Same colours as write_state_to_image, for paths that read the board back instead of sharing the GL texture
+__kernel void write_state_to_pixels(__global const char *state, __global uchar4 *pixels, int width, int height, __global const uint *heat, int tiles_x, int tile){
+	int x, y;
+	if (!cell_coords(width, height, &x, &y)){
+		return;
+	}
+	size_t index = (size_t)y*width+x;
+	if (state[index]==0){
+		pixels[index]=(uchar4)(0,0,0,255);
+	}
+	else if (state[index]==1){
+		pixels[index]=(uchar4)(255,255,255,255);
+	}
+	else{
+		pixels[index]=(uchar4)(0,0,255,255);
+	}
+	pixels[index].w = (uchar)(heat_level(heat, tiles_x, tile, x, y)*255.0f);
+}
+
 __kernel void initialize_state(__global char *state, int border_width, int width, int height){
-	size_t index = get_global_id(0);
-	if (index/width < border_width || index/width>=height-border_width || index%width < border_width || index%width>=width-border_width){
-		state[index]=2;
+	int x, y;
+	if (!cell_coords(width, height, &x, &y)){
+		return;
+	}
+	if (y < border_width || y>=height-border_width || x < border_width || x>=width-border_width){
+		state[(size_t)y*width+x]=2;
 	}
 	else{
-		state[index]=0;
+		state[(size_t)y*width+x]=0;
 	}
 }
 
@@ -60,4 +180,235 @@ __kernel void flip_square(__global char *state, int square_x, int square_y, int
 	if (state[width*square_y+square_x]!=2){
 		state[width*square_y+square_x]=1-state[width*square_y+square_x];
 	}
-}
\ No newline at end of file
+}
+
+//Slab (multi-device) kernels. Each slab buffer holds its own rows plus one halo row above and one below.
+__kernel void initialize_slab(__global char *state, int border_width, int width, int height, int first_row){
+	size_t index = get_global_id(0);
+	int x = index % width; int y = first_row-1+(int)(index / width); //Global row; local row 0 is the halo above
+	if (y<border_width || y>=height-border_width || x<border_width || x>=width-border_width){
+		state[index]=2;
+	}
+	else{
+		state[index]=0;
+	}
+}
+
+//Fused adjacency count and update for local rows [first_row, first_row+get_global_size(1)) of a slab
+__kernel void step_rows(__global const char *src, __global char *dst, int width, int first_row){
+	size_t index = (first_row+get_global_id(1))*width+get_global_id(0);
+	char s = src[index];
+	if (s==2){ //Border cells never change, and always sit between any interior cell and the buffer edge
+		dst[index]=2;
+		return;
+	}
+	int n = (src[index-width-1]&1)+(src[index-width]&1)+(src[index-width+1]&1)
+	       +(src[index-1]&1)+(src[index+1]&1)
+	       +(src[index+width-1]&1)+(src[index+width]&1)+(src[index+width+1]&1);
+	dst[index]=(n==3)|((n==2)&s);
+}
+
+//Image engine: the board lives in two CL_R/CL_UNSIGNED_INT8 images and one generation is a 2D NDRange over the whole
+//image. Reads past the edge return the clamp colour (0), and border cells are kept by select() instead of a branch.
+__constant sampler_t board_sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
+
+__kernel void step_image(__read_only image2d_t src, __write_only image2d_t dst){
+	int2 pos = (int2)(get_global_id(0), get_global_id(1));
+	uint s = read_imageui(src, board_sampler, pos).x;
+	uint n = (read_imageui(src, board_sampler, pos+(int2)(-1,-1)).x&1)+(read_imageui(src, board_sampler, pos+(int2)(0,-1)).x&1)+(read_imageui(src, board_sampler, pos+(int2)(1,-1)).x&1)
+	        +(read_imageui(src, board_sampler, pos+(int2)(-1,0)).x&1)+(read_imageui(src, board_sampler, pos+(int2)(1,0)).x&1)
+	        +(read_imageui(src, board_sampler, pos+(int2)(-1,1)).x&1)+(read_imageui(src, board_sampler, pos+(int2)(0,1)).x&1)+(read_imageui(src, board_sampler, pos+(int2)(1,1)).x&1);
+	uint next = (n==3)|((n==2)&s);
+	write_imageui(dst, pos, (uint4)(select(next, s, (uint)(s==2)), 0, 0, 0));
+}
+
+//Tiled engine layout: the board is cut into TILE_SIDE square bricks, each stored whole with its cells row-major. Bricks
+//run in Z-order inside groups of TILE_GROUP x TILE_GROUP bricks and the groups run row-major, so cells that are near
+//each other on the board are near each other in memory however wide the board is.
+#define TILE_SIDE 64
+#define TILE_GROUP 8
+size_t brick_offset(int bx, int by, int groups_x){
+	uint z=0;
+	for (int b=0;b<3;b++){ //Interleaves the brick's position in its group, TILE_GROUP being 2^3
+		z |= (((bx%TILE_GROUP)>>b)&1)<<(2*b) | (((by%TILE_GROUP)>>b)&1)<<(2*b+1);
+	}
+	size_t group = (size_t)(by/TILE_GROUP)*groups_x+bx/TILE_GROUP;
+	return (group*TILE_GROUP*TILE_GROUP+z)*TILE_SIDE*TILE_SIDE;
+}
+
+//Launched over the whole padded layout; cells past the board edges become border
+__kernel void tile_state(__global const char *state, __global char *tiled, int width, int height, int groups_x){
+	int x = get_global_id(0); int y = get_global_id(1);
+	char s = x<width && y<height?state[(size_t)y*width+x]:2;
+	tiled[brick_offset(x/TILE_SIDE, y/TILE_SIDE, groups_x)+(y%TILE_SIDE)*TILE_SIDE+x%TILE_SIDE]=s;
+}
+
+__kernel void untile_state(__global const char *tiled, __global char *state, int width, int height, int groups_x){
+	int x, y;
+	if (!cell_coords(width, height, &x, &y)){
+		return;
+	}
+	state[(size_t)y*width+x]=tiled[brick_offset(x/TILE_SIDE, y/TILE_SIDE, groups_x)+(y%TILE_SIDE)*TILE_SIDE+x%TILE_SIDE];
+}
+
+//One work-group per brick, TILE_SIDE wide and a power of two high (at most TILE_SIDE, so it divides it). The brick and a one-cell halo from its
+//eight neighbours are loaded into halo ((TILE_SIDE+2)^2 bytes) first, so every neighbour read after that is local.
+//Bricks past bricks_x or bricks_y read as dead.
+__kernel void step_tiled(__global const char *src, __global char *dst, int bricks_x, int bricks_y, int groups_x, __local char *halo){
+	int bx = get_group_id(0); int by = get_group_id(1);
+	int lx = get_local_id(0); int ly = get_local_id(1);
+	int threads = get_local_size(0)*get_local_size(1); int side = TILE_SIDE+2;
+	for (int i=ly*get_local_size(0)+lx;i<side*side;i+=threads){
+		int hx = i%side-1; int hy = i/side-1;
+		int nbx = bx+(hx<0?-1:hx>=TILE_SIDE); int nby = by+(hy<0?-1:hy>=TILE_SIDE);
+		char s = 0;
+		if (nbx>=0 && nby>=0 && nbx<bricks_x && nby<bricks_y){
+			s = src[brick_offset(nbx, nby, groups_x)+((hy+TILE_SIDE)%TILE_SIDE)*TILE_SIDE+(hx+TILE_SIDE)%TILE_SIDE];
+		}
+		halo[i]=s;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	size_t brick = brick_offset(bx, by, groups_x);
+	for (int y=ly;y<TILE_SIDE;y+=get_local_size(1)){
+		__local const char *row = halo+(y+1)*side+lx+1;
+		char s = row[0];
+		int n = (row[-side-1]&1)+(row[-side]&1)+(row[-side+1]&1)+(row[-1]&1)+(row[1]&1)+(row[side-1]&1)+(row[side]&1)+(row[side+1]&1);
+		char next = (n==3)|((n==2)&s);
+		dst[brick+y*TILE_SIDE+lx] = s==2?2:next;
+	}
+}
+
+//Rewind history: packs bit 0 of 32 cells per work-item, stores the XOR against the previous packed board in delta and
+//keeps the new packed board in previous. Border cells are always 2, so they never show up in a delta.
+__kernel void pack_delta(__global const char *state, __global uint *previous, __global uint *delta, uint cells){
+	size_t word = get_global_id(0);
+	size_t first = word*32;
+	uint bits = 0;
+	for (uint b=0;b<32 && first+b<cells;b++){
+		bits |= (uint)(state[first+b]&1)<<b;
+	}
+	delta[word] = bits^previous[word];
+	previous[word] = bits;
+}
+
+__kernel void unpack_state(__global const uint *packed, __global char *state, uint cells){
+	size_t i = get_global_id(0);
+	if (i<cells && state[i]!=2){
+		state[i] = (packed[i/32]>>(i%32))&1;
+	}
+}
+
+//History compaction: the nonzero words of a packed board become (index, word) pairs in index order, so only the part
+//of the board that changed is read back. Each work-item of count_words and compact_words covers block words.
+__kernel void count_words(__global const uint *words, uint count, uint block, __global uint *offsets){
+	uint first = get_global_id(0)*block;
+	uint nonzero = 0;
+	for (uint i=first;i<first+block && i<count;i++){
+		nonzero += words[i]!=0;
+	}
+	offsets[get_global_id(0)] = nonzero;
+}
+
+//Runs as a single work-item: turns the per-block counts into offsets, with the total after the last block
+__kernel void scan_counts(__global uint *offsets, uint blocks){
+	uint total = 0;
+	for (uint b=0;b<blocks;b++){
+		uint nonzero = offsets[b];
+		offsets[b] = total;
+		total += nonzero;
+	}
+	offsets[blocks] = total;
+}
+
+__kernel void compact_words(__global const uint *words, uint count, uint block, __global const uint *offsets, __global uint *pairs){
+	uint first = get_global_id(0)*block;
+	uint out = offsets[get_global_id(0)]*2;
+	for (uint i=first;i<first+block && i<count;i++){
+		if (words[i]!=0){
+			pairs[out++] = i;
+			pairs[out++] = words[i];
+		}
+	}
+}
+
+//Philox4x32-10 counter-based RNG. philox() in main.c is the same function for host-side fills; keep them identical.
+uint4 philox(uint4 counter, uint2 key){
+	for (int r=0;r<10;r++){
+		uint lo0 = 0xD2511F53u*counter.x; uint hi0 = mul_hi(0xD2511F53u, counter.x);
+		uint lo1 = 0xCD9E8D57u*counter.z; uint hi1 = mul_hi(0xCD9E8D57u, counter.z);
+		counter = (uint4)(hi1^counter.y^key.x, lo1, hi0^counter.w^key.y, lo0);
+		key += (uint2)(0x9E3779B9u, 0xBB67AE85u);
+	}
+	return counter;
+}
+
+//Fills the rectangle at (x0, y0) with cells alive with probability threshold/2^32, leaving border cells alone. Each
+//cell only depends on its position, the seed and the stream, so the result is the same for any launch shape. state
+//starts at board row first_row: 0 for the whole board, a slab's first row (its halo) otherwise.
+__kernel void fill_random(__global char *state, int width, int x0, int y0, uint seed_lo, uint seed_hi, uint stream, ulong threshold, int first_row){
+	int x = x0+get_global_id(0); int y = y0+get_global_id(1);
+	size_t i = (size_t)(y-first_row)*width+x;
+	if (state[i]!=2){
+		state[i] = philox((uint4)(x, y, stream, 0), (uint2)(seed_lo, seed_hi)).x < threshold;
+	}
+}
+
+//Batched boards (soup search and ensembles): width*height boards back to back, one per get_global_id(2), with dead cells
+//past their edges. Each board has its own rule: bit n of rules[board] is birth with n live neighbours, bit 9+n survival
+//with n (B3/S23 is 0x1808). Launched with a power-of-two work-group in x and y and 1 in z, so a group never spans two
+//boards; its population, births and deaths are summed in scratch and added to stats[(column*boards+board)*3]. With stats
+//NULL (the soup search) the sums are skipped; the whole launch takes the same branch, so no barrier is left waiting.
+__kernel void step_batch(__global const char *src, __global char *dst, int width, int height, __global const uint *rules, __global uint *stats, int column, __local uint *scratch){
+	int x = get_global_id(0); int y = get_global_id(1); size_t board = get_global_id(2);
+	size_t base = board*width*height;
+	uint s=0; uint next=0;
+	if (x<width && y<height){ //Padding work-items only take part in the sums
+		int n=0;
+		for (int dy=-1;dy<=1;dy++){
+			for (int dx=-1;dx<=1;dx++){
+				int nx = x+dx; int ny = y+dy;
+				n += (dx!=0 || dy!=0) && nx>=0 && nx<width && ny>=0 && ny<height ? src[base+ny*width+nx] : 0;
+			}
+		}
+		s = src[base+y*width+x];
+		next = (rules[board]>>(n+9*s))&1;
+		dst[base+y*width+x] = next;
+	}
+	if (stats==0){
+		return;
+	}
+
+	size_t lid = get_local_id(1)*get_local_size(0)+get_local_id(0); size_t group = get_local_size(0)*get_local_size(1);
+	scratch[lid] = next; scratch[group+lid] = next&~s; scratch[2*group+lid] = s&~next;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (size_t half=group/2;half>0;half/=2){
+		if (lid<half){
+			scratch[lid]+=scratch[lid+half]; scratch[group+lid]+=scratch[group+lid+half]; scratch[2*group+lid]+=scratch[2*group+lid+half];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid==0){
+		__global uint *out = stats+((size_t)column*get_global_size(2)+board)*3;
+		atomic_add(&out[0], scratch[0]); atomic_add(&out[1], scratch[group]); atomic_add(&out[2], scratch[2*group]);
+	}
+}
+
+//Puts soup soups[i] (a Philox stream) in the middle of board slots[i], soup_width by soup_height cells, and clears the
+//rest. Counter word 3 is 1 so soups never repeat the board fills of fill_random.
+__kernel void seed_soups(__global char *state, __global const uint *slots, __global const uint *soups, int width, int height, int soup_width, int soup_height, uint seed_lo, uint seed_hi, ulong threshold){
+	int x = get_global_id(0); int y = get_global_id(1); size_t i = get_global_id(2);
+	int sx = x-(width-soup_width)/2; int sy = y-(height-soup_height)/2;
+	bool inside = sx>=0 && sx<soup_width && sy>=0 && sy<soup_height;
+	state[(size_t)slots[i]*width*height+y*width+x] = inside && philox((uint4)(sx, sy, soups[i], 1), (uint2)(seed_lo, seed_hi)).x < threshold;
+}
+
+//One FNV-1a hash per board, written to column of a window of hashes per board
+__kernel void hash_boards(__global const char *state, __global uint *hashes, int size, int window, int column){
+	size_t board = get_global_id(0);
+	__global const char *b = state+board*size*size;
+	uint h = 2166136261u;
+	for (int i=0;i<size*size;i++){
+		h = (h^b[i])*16777619u;
+	}
+	hashes[board*window+column] = h;
+}
@@ -1,11 +1,29 @@
 //An OpenCL/OpenGL implementation of Conway's game of life by Stephen Newman.
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h> 
 #include <string.h>
 #include <time.h> 
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <pthread.h>
 
 #include <glad/glad.h>
+#include <png.h>
+#include <zlib.h>
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 // #ifdef __APPLE__
 // #include <OpenCL/opencl.h>
@@ -40,6 +58,31 @@
 
 cl_platform_id platform_id;
 cl_device_id device_id;
+
+//Device selection (--platform, --device). Without cl_khr_gl_sharing (or with --no-gl-sharing) the board is colored
+//into host-mapped CL buffers and uploaded to the texture through a pixel buffer object instead.
+#define MAX_PLATFORMS (16)
+#define MAX_DEVICES (64)
+int platform_index=0;
+int device_index=-1; //-1 takes the platform's default device
+bool force_no_sharing=false;
+bool list_devices=false;
+bool gl_sharing=true;
+#define UPLOAD_BUFFERS (2)
+cl_mem upload_pixels[UPLOAD_BUFFERS];
+void *upload_mapped[UPLOAD_BUFFERS];
+cl_event upload_mapped_event[UPLOAD_BUFFERS];
+int upload_current;
+GLuint upload_pbo;
+
+//GL/CL handoff with sync objects instead of glFinish/clFinish: a GL fence turned into a CL event gates the acquire
+//(cl_khr_gl_event), and the release event turned into a GL sync gates the draw (GL_ARB_cl_event). cl_khr_gl_event alone
+//already makes acquire and release synchronize implicitly. Without it, or with --no-gl-sync, the loop drains both
+//pipelines as before.
+bool gl_event_sync=false;
+bool force_no_gl_sync=false;
+cl_event (CL_API_CALL *createEventFromGLsync)(cl_context, cl_GLsync, cl_int *);
+GLsync (APIENTRY *createSyncFromCLevent)(struct _cl_context *, struct _cl_event *, GLbitfield);
 cl_uint ret_num_devices;
 cl_uint ret_num_platforms;
 cl_int ret;
@@ -49,6 +92,10 @@ cl_command_queue command_queue;
 
 cl_program program;
 
+//Compiled program binaries are cached here, keyed by a hash of everything that affects the compiled output
+#define BINARY_CACHE_DIR ".clcache"
+bool binary_cache_enabled=true;
+
 GLFWwindow* window;
 
 
@@ -61,6 +108,74 @@ cl_kernel flipSquare;
 
 int window_width; int window_height;
 int game_width; int game_height;
+size_t game_pixels;
+size_t work_group_size = 256; //Default batch size
+
+//Launch shape of each board kernel. The default is 1D with work_group_size items per group; --autotune benchmarks 1D and
+//2D shapes on the current device and keeps the winners in BINARY_CACHE_DIR, from where later launches pick them up.
+enum {LAUNCH_ZERO_ADJACENCIES, LAUNCH_COMPUTE_ADJACENCIES, LAUNCH_COMPUTE_STATE, LAUNCH_WRITE_STATE, LAUNCH_INITIALIZE_STATE, LAUNCH_KINDS};
+const char *launch_names[LAUNCH_KINDS]={"zero_adjacencies", "compute_adjacencies", "compute_state", "write_state", "initialize_state"};
+
+typedef struct {
+	cl_uint dims;
+	size_t local[2]; //local[0]==0 lets the driver pick
+	size_t global[2]; //Board size, rounded up to a multiple of local
+} launch_shape;
+
+launch_shape launch_shapes[LAUNCH_KINDS];
+bool autotune=false;
+
+//Pacing: generations run off a fixed-timestep accumulator on CLOCK_MONOTONIC, and the loop sleeps until the next
+//generation or redraw is due. clock_nanosleep wakes PACING_SPIN_TAIL early and the rest is spun, since sleeps overshoot.
+//With --vsync, buffer swaps wait for the display instead.
+#define PACING_SPIN_TAIL 0.001
+#define PACING_MAX_LAG 0.25 //Generations further behind than this are skipped rather than caught up
+bool vsync=false;
+
+#define RESIZE_SETTLE 0.25 //Seconds the window size must hold still before --resize-with-window resizes the board
+bool resize_with_window=false;
+
+//Adaptive frame skipping: sim_cost (seconds per generation) and render_cost (state write, handoff, draw and swap) are
+//moving averages. When drawing every refresh would leave too little time for game_frame_rate generations, draws are
+//spaced render_interval apart instead, never more than max_frame_latency, and the skipped refreshes count as dropped.
+//No iteration runs more generations than fit in max_frame_latency, so input keeps being read under load.
+//sim_cost is measured without waiting on the queue: markers before and after a frame's generations note when they
+//complete from an event callback, and a later frame takes the sample once both have.
+#define COST_SMOOTHING 0.1
+double max_frame_latency=0.1; //--max-latency MS
+double sim_cost=0; double render_cost=0;
+pthread_mutex_t sim_timing_mutex = PTHREAD_MUTEX_INITIALIZER;
+double sim_timing_start; double sim_timing_end; //Set by simMarkerDone, 0 until the marker completes
+int sim_timing_generations; //Generations between the markers in flight, 0 if none
+
+//Differential check (--verify): every engine runs the same starting boards for --generations, and its final board is
+//compared with the buffer engine's, which keeps the original compute_adjacencies/compute_state semantics. The batch
+//and host engines (the ensemble and search steppers) have no border cells, so they run on the board's interior.
+enum {VERIFY_BUFFER, VERIFY_HEATMAP, VERIFY_IMAGE, VERIFY_TILED, VERIFY_SLABS, VERIFY_BATCH, VERIFY_HOST, VERIFY_ENGINES};
+const char *verify_engine_names[VERIFY_ENGINES]={"buffer", "buffer+heatmap", "image", "tiled", "slabs", "batch", "host"};
+bool verify=false;
+
+//Presentation benchmark (--bench-present): for each board size in --bench-sizes, times BENCH_FRAMES frames of every way
+//of getting the board into the texture and on screen. interop is the shared texture (acquire, write_state_to_image,
+//release), pbo the double-buffered upload used without sharing, host a plain read back followed by glTexSubImage2D.
+#define BENCH_FRAMES 100
+#define MAX_BENCH_SIZES 16
+bool bench_present=false;
+int bench_sizes[MAX_BENCH_SIZES]={512, 1024, 2048, 4096}; int num_bench_sizes=4;
+
+//Board size and length of the headless modes (--board, --generations), which have no screen to take them from
+int board_option_width=4096; int board_option_height=4096;
+int run_generations=1000;
+
+//Headless rendering (--headless): no window or GL sharing. Every render_every generations the board is read back,
+//drawn offscreen with the normal shaders and written as a PNG by a pool of encoder threads.
+#define MAX_PNG_THREADS (32)
+#define PNG_QUEUE (16)
+bool headless=false;
+int render_every=100;
+const char *output_dir=".";
+int png_threads=4;
+cl_kernel writeStateToPixels;
 
 #define BORDER_WIDTH (25)
 //Border is 2, dead is 0, alive is 1.
@@ -84,25 +199,286 @@ GLint posAttrib;
 cl_mem game_state;
 cl_mem adjacencies;
 
+//Image engine (--engine image): generations are stepped between two 2D images instead of game_state. The result is
+//copied back into game_state only when a draw, an edit or a history record reads it (syncBoard).
+bool image_engine=false;
+cl_mem state_images[2];
+int image_current;
+bool engine_stale=true; //game_state was edited since it was last copied into the image or tiled engine's own copy
+cl_kernel stepImage;
+
+//Tiled engine (--engine tiled): generations are stepped between two copies of the board cut into TILE_SIDE square
+//bricks in Z-order (layout in cl_kernel.cl), one work-group per brick with its halo in local memory, so neighbour reads
+//stay within a few kilobytes however wide the board is. Like the image engine, it is converted back into game_state
+//only when something reads it (syncBoard).
+#define TILE_SIDE 64
+#define TILE_GROUP 8
+bool tiled_engine=false;
+cl_mem state_tiles[2];
+int tiles_current;
+int tile_bricks_x; int tile_bricks_y; int tile_groups_x; int tile_groups_y;
+size_t tile_rows; //Work-group height of step_tiled
+cl_kernel tileState; cl_kernel untileState; cl_kernel stepTiled;
+
+//Activity heatmap ("h", --heatmap FILE): with it on, compute_state_heat replaces compute_state and counts changed cells
+//per HEAT_TILE square tile, decay_heat fades the counts each generation, and the write kernels put them in the texture's
+//alpha channel for the fragment shader to tint. Buffer engine only. --heatmap writes the grid to FILE on exit.
+#define HEAT_TILE 32
+#define HEAT_UNIT 256 //Added to a tile's count for each changed cell
+#define HEAT_DECAY_SHIFT 4 //Counts fade by 1/2^HEAT_DECAY_SHIFT each generation
+#define HEAT_PER_CHANGE (HEAT_UNIT<<HEAT_DECAY_SHIFT) //A count's steady state per change per generation
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+//Build options of every program built from cl_kernel.cl, so the kernels and the host share the constants above.
+//Cached launch shapes are keyed on them and the source too.
+const char *program_options = "-D HEAT_UNIT=" TO_STRING(HEAT_UNIT) " -D HEAT_DECAY_SHIFT=" TO_STRING(HEAT_DECAY_SHIFT);
+bool heatmap=false;
+const char *heatmap_path=NULL;
+int heat_tiles_x; int heat_tiles_y;
+cl_mem heat_counts;
+cl_kernel updateStateHeat; cl_kernel decayHeat;
+
+//Random fills (--seed, --density): the starting soup of headless and distributed runs, the right-click randomizer and
+//"r" all draw from Philox keyed by soup_seed, with a stream number per fill
+cl_ulong soup_seed=1;
+float soup_density=0.5f;
+cl_uint soup_stream=1; //Stream 0 is the starting soup
+cl_kernel fillRandom;
+
+//Soup search (--search N): N random SEARCH_SOUP square soups (Philox streams under --seed and --density), each in the
+//middle of its own SEARCH_BOARD square board, --search-batch boards stepped per launch. A board is settled once its hash
+//repeats with a period of at most SEARCH_MAX_PERIOD, checked over SEARCH_WINDOW generations after every SEARCH_CHUNK.
+//The ash of settled boards is split into objects whose counts are written to census_path.
+#define SEARCH_BOARD 64
+#define SEARCH_SOUP 16
+#define SEARCH_CHUNK 32
+#define SEARCH_WINDOW 16
+#define SEARCH_MAX_PERIOD 8
+#define SEARCH_MAX_GENERATIONS 4096
+#define CANONICAL_LENGTH 4096
+long search_soups=0;
+int search_batch=1024;
+const char *census_path="census.txt";
+
+//Ensemble mode (--rules LIST, --seeds N): one board per rule and seed, all advanced by the same step_batch launches.
+//Population, births and deaths of every board are summed in the kernel and written to ensemble_csv_path.
+#define MAX_RULES 64
+#define ENSEMBLE_STATS_CHUNK 64 //Generations of statistics read back at once
+#define LIFE_RULE 0x1808 //B3/S23 in step_batch's rule masks
+cl_uint ensemble_rules[MAX_RULES];
+char *ensemble_rule_names[MAX_RULES];
+int num_rules=0;
+int ensemble_seeds=1;
+bool ensemble=false;
+const char *ensemble_csv_path="ensemble.csv";
+bool board_option_set=false;
+
+typedef struct {
+	char *code;
+	long count;
+} census_entry;
+census_entry *census; size_t census_capacity; size_t census_used;
+
+//Rewind history (Z steps back, X forward): each frame that changes the board appends its XOR against the previous
+//entry, bit-packed on the device and zero-run compressed on the host. Every HISTORY_KEYFRAME_INTERVAL entries the
+//whole packed board is stored instead, so a rewind replays at most that many deltas. Oldest keyframe blocks are
+//dropped to stay within history_budget bytes. A frame can run several generations, so an entry (and a journal record)
+//stores its span, the generations since the record before it; stepping through the history moves by whole entries.
+//Only the nonzero packed words are read back: the device compacts them into (index, word) pairs, and the read is
+//not waited for. The record is taken in by the next historyRecord or historyFlush, by which time it has long finished.
+#define HISTORY_KEYFRAME_INTERVAL 64
+#define HISTORY_BLOCK 256 //Packed words per work-item of the compaction
+#define HISTORY_READ_MIN 4096 //Pairs read together with the count. A bigger record reads the rest when it is taken in.
+enum {HISTORY_DELTA, HISTORY_FULL};
+typedef struct {
+	bool keyframe;
+	unsigned long generation;
+	unsigned long span; //Generations since the entry before, 0 for the first one and after a rewind
+	cl_uint *data; //Zero-run encoded packed words
+	size_t length;
+} history_entry;
+size_t history_budget = (size_t)256<<20; //--history-mb, 0 disables
+history_entry *history;
+int history_count; int history_capacity;
+int history_cursor=-1; //Entry currently on the board
+int history_since_keyframe;
+size_t history_bytes;
+bool history_enabled;
+size_t history_words; //Packed words per board, 0 while neither the history nor the journal is on
+cl_uint *history_encoded; cl_uint *history_board;
+unsigned long board_generation; //Generations since start, rewound along with the board
+cl_mem history_previous; cl_mem history_delta;
+cl_mem history_offsets[2]; cl_mem history_pairs[2]; //Per kind: block offsets with the total at the end, and the pairs
+cl_uint *history_host_pairs[2]; cl_uint history_totals[2]; size_t history_guess[2];
+bool history_pending; bool history_want[2]; bool history_pending_keyframe; bool history_pending_journal_keyframe;
+unsigned long history_pending_generation; unsigned long history_pending_span; cl_event history_read;
+unsigned long recorded_generation; //Generation of the newest record, which the next record's span counts from
+cl_kernel packDelta; cl_kernel unpackState; cl_kernel countWords; cl_kernel scanCounts; cl_kernel compactWords;
+
+//Journal (--journal FILE): every history record is also appended to FILE by a writer thread, zlib-compressed. A full
+//board is written every JOURNAL_KEYFRAME_INTERVAL records, after a rewind and after a dropped record, and FILE.idx gets
+//the generation and file offset of each keyframe so --replay can seek. --journal-policy decides what happens when the
+//writer falls JOURNAL_QUEUE records behind: drop them (default), throttle the simulation, or buffer without limit.
+#define JOURNAL_KEYFRAME_INTERVAL 1024
+#define JOURNAL_QUEUE 64
+#define JOURNAL_MAGIC 0x4a4c4743 //"CGLJ"
+enum {JOURNAL_DROP, JOURNAL_THROTTLE, JOURNAL_BUFFER};
+typedef struct {
+	cl_uint magic, version, width, height;
+} journal_header;
+typedef struct {
+	cl_uint keyframe;
+	cl_uint encoded_words; //Zero-run encoded length before compression
+	cl_uint compressed_bytes;
+	cl_uint span; //Generations since the record before, 0 after a rewind (and in version 1 journals)
+	cl_ulong generation;
+} journal_record;
+typedef struct {
+	cl_ulong generation, offset;
+} journal_index_entry;
+typedef struct journal_job {
+	struct journal_job *next;
+	bool keyframe;
+	unsigned long generation; unsigned long span;
+	size_t length;
+	cl_uint data[];
+} journal_job;
+
+const char *journal_path=NULL;
+int journal_policy=JOURNAL_DROP;
+FILE *journal_file; FILE *journal_index;
+journal_job *journal_head; journal_job *journal_tail;
+int journal_queued;
+bool journal_stopping;
+bool journal_need_keyframe=true;
+int journal_since_keyframe;
+long journal_records, journal_dropped;
+pthread_t journal_thread;
+pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t journal_ready = PTHREAD_COND_INITIALIZER;
+pthread_cond_t journal_space = PTHREAD_COND_INITIALIZER;
+const char *replay_path=NULL;
+long replay_seek=-1; //-1 replays to the end
+
+//Multi-device mode (--slabs): the board is split into horizontal slabs, each stepped on its own device in a separate
+//compute context. Each slab keeps one halo row above and below its own rows, refreshed from its neighbours every generation.
+#define MAX_SLABS (64)
+int num_slabs=0; //0 disables slab mode
+bool slabs_all_devices=false;
+
+typedef struct {
+	cl_device_id device;
+	cl_command_queue compute_queue;
+	cl_command_queue transfer_queue; //Halo copies go here so they overlap the interior update
+	cl_program program;
+	cl_kernel step_rows; cl_kernel initialize_slab; cl_kernel flip; cl_kernel fill;
+	cl_mem state[2]; //Ping-pong, (rows+2)*game_width each
+	int first_row; int rows; //Global rows owned by this slab
+	cl_event boundary_done; //First and last owned rows of the newest generation are written
+	cl_event halo_ready[2]; //Halo rows (above, below) of the newest generation are in place
+} slab;
+
+slab slabs[MAX_SLABS];
+cl_context slab_context;
+int slab_current=0; //Index into state[] of the newest generation
+char *slab_host_board; //Staging for assembling the slabs into game_state for display
+bool board_behind=false; //game_state is older than the board the engine keeps, see syncBoard
+
+//Distributed mode (--ranks): a headless run where the board is split into horizontal strips, one per forked process,
+//each with its own OpenCL context. Halo rows go through a shared memory segment, or Unix domain sockets with --transport socket.
+#define MAX_RANKS (64)
+int num_ranks=0; //0 disables distributed mode
+bool rank_sockets=false;
+#define RANK_POLL_MS 100 //How often a rank blocked on a halo socket checks that the run is still alive
+pid_t rank_parent; //The parent reaps the ranks and kills the rest when one fails; a rank that outlives it stops
+
+typedef struct {
+	double wall; double compute; double boundary_wait; double halo_wait; //Seconds
+	long halo_bytes; long population; int rows;
+} rank_timing;
+
+typedef struct {
+	rank_timing timing;
+	long published[2]; //Newest generation whose top (0) and bottom (1) rows are in this rank's slots
+} rank_shared;
+
 
 GLuint shaderProgram;
 
+//Recording (--record): the board texture is read back into a ring of pixel buffer objects with asynchronous glReadPixels,
+//and each one is only mapped once its fence has signalled. Frames are handed to a writer thread, or dropped if it falls behind.
+#define CAPTURE_PBOS (3)
+#define CAPTURE_QUEUE (8)
+const char *capture_path=NULL;
+bool capture_y4m;
+FILE *capture_file;
+GLuint capture_fbo;
+GLuint capture_pbos[CAPTURE_PBOS];
+GLsync capture_fences[CAPTURE_PBOS];
+int capture_next_pbo; int capture_pending_pbos; //Round-robin; the oldest pending one is (next-pending)
+char *capture_queue[CAPTURE_QUEUE];
+int capture_queue_head; int capture_queue_count;
+bool capture_stopping;
+pthread_t capture_thread;
+pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t capture_cond = PTHREAD_COND_INITIALIZER;
+long frames_captured; long frames_dropped;
+
 
 double rawScroll;
 
-int powerOfTwoAbove(int i){
-	int p=1;
-	while (p<i){
-		p*=2;
-	}
-	return p;
-}
+//Optional per-kernel profiling, enabled with --profile. Every enqueue that is handed an event from profileEvent()
+//gets its queued/submit/start/end times folded into a rolling window of samples for that kernel.
+bool profiling_enabled=false;
+const char *profile_csv_path="profile.csv";
+
+#define PROFILE_SAMPLES (1024) //Rolling window size per kernel
+#define MAX_PENDING_EVENTS (512) //Events waiting to be read back at the end of a frame
+
+enum {PROFILE_ZERO_ADJACENCIES, PROFILE_COMPUTE_ADJACENCIES, PROFILE_COMPUTE_STATE, PROFILE_WRITE_STATE_TO_IMAGE, PROFILE_INITIALIZE_STATE, PROFILE_FLIP_SQUARE, PROFILE_GL_ACQUIRE, PROFILE_GL_RELEASE, PROFILE_STEP_IMAGE, PROFILE_BOARD_COPY, PROFILE_STEP_TILED, PROFILE_KINDS};
+const char *profile_names[PROFILE_KINDS]={"zero_adjacencies", "compute_adjacencies", "compute_state", "write_state_to_image", "initialize_state", "flip_square", "gl_acquire", "gl_release", "step_image", "board_copy", "step_tiled"};
+
+typedef struct {
+	float queue_us[PROFILE_SAMPLES]; //submit-queued
+	float submit_us[PROFILE_SAMPLES]; //start-submit
+	float exec_us[PROFILE_SAMPLES]; //end-start
+	int samples; int next;
+	long calls; double total_exec_us;
+} kernel_profile;
+
+kernel_profile profiles[PROFILE_KINDS];
+
+//Frame metrics. The main loop only stores into a fixed ring; a summary is built from it every stats_interval seconds.
+#define METRICS_SAMPLES (4096)
+float stats_interval=1.0f; //Seconds between summaries, 0 disables them
+bool stats_json=false;
+
+typedef struct {
+	float frame_ms[METRICS_SAMPLES];
+	unsigned long frames; //Total frames recorded
+	unsigned long generations; //Total generations computed
+	unsigned long reported_frames; unsigned long reported_generations; //Totals at the last summary
+	unsigned long draws; unsigned long dropped; //Frames drawn, and display refreshes skipped to keep up
+	unsigned long reported_draws; unsigned long reported_dropped;
+	int generations_per_draw; //Generations shown by the last draw
+	double report_time;
+} frame_metrics;
+
+frame_metrics metrics;
+cl_event pending_events[MAX_PENDING_EVENTS];
+int pending_kinds[MAX_PENDING_EVENTS];
+int num_pending_events=0;
 
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset){
 	rawScroll+=yoffset;
 }
 
-int texture_size; //Switching to power-of-two textures
+bool window_damaged=true; //Set when the window system needs the contents redrawn, e.g. after being uncovered
+
+void refresh_callback(GLFWwindow* window){
+	window_damaged=true;
+}
+
 
 
 float clip (float val, float min, float max){
@@ -115,91 +491,402 @@ float clip (float val, float min, float max){
 	return val;
 }
 
-void glInit(){
-	//Initialization taken from http://www.opengl-tutorial.org/beginners-tutorials/tutorial-1-opening-a-window/
-	if (glfwInit() != GLFW_TRUE){
-		printf("GLFW init failed!");
-		exit(-1);
+//Hands out an event slot for an enqueue of the given kind, or NULL if profiling is off (or the frame is saturated)
+cl_event* profileEvent(int kind){
+	if (!profiling_enabled || num_pending_events>=MAX_PENDING_EVENTS){
+		return NULL;
 	}
-	
+	pending_kinds[num_pending_events]=kind;
+	pending_events[num_pending_events]=NULL; //Stays NULL if the enqueue fails, and is then dropped
+	return &pending_events[num_pending_events++];
+}
 
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3); // We want OpenGL 2.1
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-	if (APPLE){
-		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
+//Reads back every pending event. Must only be called once the queue has finished.
+void collectProfileEvents(){
+	cl_ulong queued, submit, start, end;
+	for (int i=0;i<num_pending_events;i++){
+		if (pending_events[i]==NULL){
+			continue;
+		}
+		clGetEventProfilingInfo(pending_events[i], CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+		clGetEventProfilingInfo(pending_events[i], CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submit, NULL);
+		clGetEventProfilingInfo(pending_events[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+		clGetEventProfilingInfo(pending_events[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+		clReleaseEvent(pending_events[i]);
+
+		kernel_profile *p = &profiles[pending_kinds[i]];
+		p->queue_us[p->next]=(submit-queued)/1000.0f;
+		p->submit_us[p->next]=(start-submit)/1000.0f;
+		p->exec_us[p->next]=(end-start)/1000.0f;
+		p->next=(p->next+1)%PROFILE_SAMPLES;
+		if (p->samples<PROFILE_SAMPLES){
+			p->samples++;
+		}
+		p->calls++;
+		p->total_exec_us+=(end-start)/1000.0;
 	}
-	glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
+	num_pending_events=0;
+}
 
-	monitor = glfwGetPrimaryMonitor();
-	const GLFWvidmode* monitorInfo = glfwGetVideoMode(monitor);
-	window_width = monitorInfo->width; window_height = monitorInfo->height; //Grab the width of the screen.
-	window = glfwCreateWindow(window_width, window_height, "Conway", NULL, NULL);
-	texture_size = (powerOfTwoAbove(window_width)>powerOfTwoAbove(window_height))?powerOfTwoAbove(window_width):powerOfTwoAbove(window_height); //Make the texture big enough to hold the game
-	game_width = window_width; game_height = window_height;
+int compareFloats(const void *a, const void *b){
+	float fa=*(const float*)a; float fb=*(const float*)b;
+	return (fa>fb)-(fa<fb);
+}
 
-	//glfwWindowHint(GLFW_REFRESH_RATE,2000);
+//Nearest-rank percentile (0-100) of count samples. Samples are copied, not reordered.
+float percentile(const float *samples, int count, float p){
+	static float sorted[METRICS_SAMPLES];
+	if (count<=0){
+		return 0;
+	}
+	if (count>METRICS_SAMPLES){
+		count=METRICS_SAMPLES;
+	}
+	memcpy(sorted, samples, count*sizeof(float));
+	qsort(sorted, count, sizeof(float), compareFloats);
+	int index = (int)(p/100.0f*count+0.5f)-1;
+	return sorted[(int)clip(index, 0, count-1)];
+}
 
+//The overlay lives in the window title: median execution time of each kernel that has run recently
+void updateProfileOverlay(){
+	char title[1024]; int length=snprintf(title, sizeof(title), "Conway |");
+	for (int k=0;k<PROFILE_KINDS && length<(int)sizeof(title);k++){
+		if (profiles[k].samples>0){
+			length+=snprintf(title+length, sizeof(title)-length, " %s %.1fus p99 %.1fus |", profile_names[k], percentile(profiles[k].exec_us, profiles[k].samples, 50), percentile(profiles[k].exec_us, profiles[k].samples, 99));
+		}
+	}
+	glfwSetWindowTitle(window, title);
+}
 
+void writeProfileCSV(const char *path){
+	FILE *fp = fopen(path, "w");
+	if (fp==NULL){
+		printf("Could not open %s for profile output.\n", path);
+		return;
+	}
+	fprintf(fp, "kernel,calls,total_exec_ms,queue_p50_us,queue_p99_us,submit_p50_us,submit_p99_us,exec_p50_us,exec_p90_us,exec_p99_us,exec_max_us\n");
+	for (int k=0;k<PROFILE_KINDS;k++){
+		kernel_profile *p = &profiles[k];
+		fprintf(fp, "%s,%li,%.3f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n", profile_names[k], p->calls, p->total_exec_us/1000.0,
+			percentile(p->queue_us, p->samples, 50), percentile(p->queue_us, p->samples, 99),
+			percentile(p->submit_us, p->samples, 50), percentile(p->submit_us, p->samples, 99),
+			percentile(p->exec_us, p->samples, 50), percentile(p->exec_us, p->samples, 90), percentile(p->exec_us, p->samples, 99), percentile(p->exec_us, p->samples, 100));
+	}
+	fclose(fp);
+	printf("Profile written to %s\n", path);
+}
 
-	if( window == NULL ){
-	    fprintf(stderr, "Failed to open GLFW window.\n" );
-	    glfwTerminate();
-	    exit(-1);
-    }
-    glfwMakeContextCurrent(window);
-    glfwSwapInterval(0);
+static inline void recordFrame(float frame_ms, int generations){
+	metrics.frame_ms[metrics.frames%METRICS_SAMPLES]=frame_ms;
+	metrics.frames++;
+	metrics.generations+=generations;
+}
 
-    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
-        printf("Failed to initialize OpenGL context\n");
-        exit(-1);
-    }
-    unsigned const char* device_string = glGetString(GL_RENDERER);
-	printf("OpenGL device: %s\n",device_string);
-	glDisable(GL_DEPTH_TEST); glDisable(GL_MULTISAMPLE);
+//Prints one line (or JSON record) covering the frames since the previous summary
+void reportMetrics(double now, float game_frame_rate, bool paused){
+	static float window[METRICS_SAMPLES];
+	double elapsed = now-metrics.report_time;
+	unsigned long frames = metrics.frames-metrics.reported_frames;
+	unsigned long generations = metrics.generations-metrics.reported_generations;
+	int n = frames>METRICS_SAMPLES?METRICS_SAMPLES:frames;
+	for (int i=0;i<n;i++){ //Order does not matter for percentiles, so just take the last n slots
+		window[i]=metrics.frame_ms[(metrics.frames-1-i)%METRICS_SAMPLES];
+	}
+	float p50=percentile(window, n, 50); float p90=percentile(window, n, 90); float p99=percentile(window, n, 99); float max=percentile(window, n, 100);
+	unsigned long draws = metrics.draws-metrics.reported_draws;
+	unsigned long dropped = metrics.dropped-metrics.reported_dropped;
+	if (stats_json){
+		printf("{\"time\":%.3f,\"frames\":%lu,\"fps\":%.1f,\"draws_per_second\":%.1f,\"dropped\":%lu,\"generations_per_draw\":%i,\"generations_per_second\":%.1f,\"frame_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f},\"game_frame_rate\":%.1f,\"paused\":%s}\n",
+			now, frames, frames/elapsed, draws/elapsed, dropped, metrics.generations_per_draw, generations/elapsed, p50, p90, p99, max, game_frame_rate, paused?"true":"false");
+	}
+	else{
+		printf("FPS: %.1f, draws/s: %.1f, dropped: %lu, generations/draw: %i, generations/s: %.1f, frame ms p50 %.3f p90 %.3f p99 %.3f max %.3f, game frame rate: %.1f%s\n",
+			frames/elapsed, draws/elapsed, dropped, metrics.generations_per_draw, generations/elapsed, p50, p90, p99, max, game_frame_rate, paused?", paused":"");
+	}
+	fflush(stdout);
+	metrics.reported_frames=metrics.frames; metrics.reported_generations=metrics.generations;
+	metrics.reported_draws=metrics.draws; metrics.reported_dropped=metrics.dropped;
+	metrics.report_time=now;
+}
 
+//Parses a rule such as B3/S23 into a step_batch rule mask
+bool parseRule(const char *text, cl_uint *rule){
+	*rule=0; int shift=-1;
+	for (const char *c=text;*c;c++){
+		if (*c=='B' || *c=='b'){
+			shift=0;
+		}
+		else if (*c=='S' || *c=='s'){
+			shift=9;
+		}
+		else if (*c>='0' && *c<='8' && shift>=0){
+			*rule|=1u<<(shift+*c-'0');
+		}
+		else if (*c!='/'){
+			return false;
+		}
+	}
+	return shift>=0;
+}
 
+void printUsage(const char *name){
+	printf("Usage: %s [--profile] [--profile-csv FILE] [--stats-interval SECONDS] [--stats-json] [--no-binary-cache] [--autotune] [--vsync] [--max-latency MS] [--heatmap FILE] [--resize-with-window] [--engine buffer|image|tiled] [--history-mb N]\n"
+	       "       [--seed N] [--density D] [--journal FILE] [--journal-policy drop|throttle|buffer] [--slabs N|all] [--record FILE] [--platform N] [--device N] [--no-gl-sharing] [--no-gl-sync] [--list-devices]\n"
+	       "       %s --ranks N [--transport shm|socket] [--generations N] [--board WIDTHxHEIGHT]\n"
+	       "       %s --headless [--render-every N] [--output-dir DIR] [--png-threads N] [--generations N] [--board WIDTHxHEIGHT]\n"
+	       "       %s --replay FILE [--seek GENERATION] [--output-dir DIR]\n"
+	       "       %s --search N [--search-batch N] [--census FILE] [--seed N] [--density D]\n"
+	       "       %s --bench-present [--bench-sizes 512,1024,...] [--platform N] [--device N] [--no-gl-sharing]\n"
+	       "       %s --verify [--generations N] [--board WIDTHxHEIGHT] [--seed N] [--density D] [--slabs N|all]\n"
+	       "       %s --rules B3/S23,... [--seeds N] [--ensemble-csv FILE] [--generations N] [--board WIDTHxHEIGHT] [--seed N] [--density D]\n", name, name, name, name, name, name, name, name);
+}
 
+void parseArguments(int argc, char **argv){
+	for (int i=1;i<argc;i++){
+		if (strcmp(argv[i], "--profile")==0){
+			profiling_enabled=true;
+		}
+		else if (strcmp(argv[i], "--profile-csv")==0 && i+1<argc){
+			profiling_enabled=true;
+			profile_csv_path=argv[++i];
+		}
+		else if (strcmp(argv[i], "--stats-interval")==0 && i+1<argc){
+			stats_interval=atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--stats-json")==0){
+			stats_json=true;
+		}
+		else if (strcmp(argv[i], "--no-binary-cache")==0){
+			binary_cache_enabled=false;
+		}
+		else if (strcmp(argv[i], "--autotune")==0){
+			autotune=true;
+		}
+		else if (strcmp(argv[i], "--vsync")==0){
+			vsync=true;
+		}
+		else if (strcmp(argv[i], "--bench-present")==0){
+			bench_present=true;
+		}
+		else if (strcmp(argv[i], "--bench-sizes")==0 && i+1<argc){
+			num_bench_sizes=0;
+			for (char *size=strtok(argv[++i], ","); size!=NULL && num_bench_sizes<MAX_BENCH_SIZES; size=strtok(NULL, ",")){
+				bench_sizes[num_bench_sizes++]=atoi(size);
+			}
+		}
+		else if (strcmp(argv[i], "--verify")==0){
+			verify=true;
+		}
+		else if (strcmp(argv[i], "--resize-with-window")==0){
+			resize_with_window=true;
+		}
+		else if (strcmp(argv[i], "--heatmap")==0 && i+1<argc){
+			heatmap_path=argv[++i];
+			heatmap=true;
+		}
+		else if (strcmp(argv[i], "--max-latency")==0 && i+1<argc){
+			max_frame_latency=atof(argv[++i])/1000.0;
+		}
+		else if (strcmp(argv[i], "--journal")==0 && i+1<argc){
+			journal_path=argv[++i];
+		}
+		else if (strcmp(argv[i], "--journal-policy")==0 && i+1<argc){
+			i++;
+			journal_policy = strcmp(argv[i], "throttle")==0?JOURNAL_THROTTLE:strcmp(argv[i], "buffer")==0?JOURNAL_BUFFER:JOURNAL_DROP;
+			if (journal_policy==JOURNAL_DROP && strcmp(argv[i], "drop")!=0){
+				printUsage(argv[0]);
+				exit(-1);
+			}
+		}
+		else if (strcmp(argv[i], "--replay")==0 && i+1<argc){
+			replay_path=argv[++i];
+		}
+		else if (strcmp(argv[i], "--seek")==0 && i+1<argc){
+			replay_seek=atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--seed")==0 && i+1<argc){
+			soup_seed=strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--density")==0 && i+1<argc){
+			soup_density=atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--search")==0 && i+1<argc){
+			search_soups=atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--search-batch")==0 && i+1<argc){
+			search_batch=atoi(argv[++i]);
+			search_batch=search_batch<1?1:search_batch;
+		}
+		else if (strcmp(argv[i], "--rules")==0 && i+1<argc){
+			ensemble=true;
+			for (char *rule=strtok(argv[++i], ","); rule!=NULL && num_rules<MAX_RULES; rule=strtok(NULL, ",")){
+				if (!parseRule(rule, &ensemble_rules[num_rules])){
+					printf("Cannot parse rule %s\n", rule);
+					exit(-1);
+				}
+				ensemble_rule_names[num_rules++]=rule;
+			}
+		}
+		else if (strcmp(argv[i], "--seeds")==0 && i+1<argc){
+			ensemble_seeds=atoi(argv[++i]);
+			ensemble_seeds=ensemble_seeds<1?1:ensemble_seeds;
+			ensemble=true;
+		}
+		else if (strcmp(argv[i], "--ensemble-csv")==0 && i+1<argc){
+			ensemble_csv_path=argv[++i];
+		}
+		else if (strcmp(argv[i], "--census")==0 && i+1<argc){
+			census_path=argv[++i];
+		}
+		else if (strcmp(argv[i], "--history-mb")==0 && i+1<argc){
+			history_budget=(size_t)atoi(argv[++i])<<20;
+		}
+		else if (strcmp(argv[i], "--engine")==0 && i+1<argc){
+			i++;
+			image_engine = strcmp(argv[i], "image")==0;
+			tiled_engine = strcmp(argv[i], "tiled")==0;
+			if (!image_engine && !tiled_engine && strcmp(argv[i], "buffer")!=0){
+				printUsage(argv[0]);
+				exit(-1);
+			}
+		}
+		else if (strcmp(argv[i], "--slabs")==0 && i+1<argc){
+			i++;
+			slabs_all_devices = strcmp(argv[i], "all")==0;
+			num_slabs = slabs_all_devices?1:atoi(argv[i]);
+			if (num_slabs<1){
+				printUsage(argv[0]);
+				exit(-1);
+			}
+		}
+		else if (strcmp(argv[i], "--record")==0 && i+1<argc){
+			capture_path=argv[++i];
+			if (strcmp(capture_path, "-")==0){ //Keep the real stdout for the video and send our own output to stderr
+				capture_file = fdopen(dup(STDOUT_FILENO), "wb");
+				dup2(STDERR_FILENO, STDOUT_FILENO);
+			}
+		}
+		else if (strcmp(argv[i], "--platform")==0 && i+1<argc){
+			platform_index=atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--device")==0 && i+1<argc){
+			device_index=atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-gl-sharing")==0){
+			force_no_sharing=true;
+		}
+		else if (strcmp(argv[i], "--no-gl-sync")==0){
+			force_no_gl_sync=true;
+		}
+		else if (strcmp(argv[i], "--list-devices")==0){
+			list_devices=true;
+		}
+		else if (strcmp(argv[i], "--headless")==0){
+			headless=true;
+		}
+		else if (strcmp(argv[i], "--render-every")==0 && i+1<argc){
+			render_every=atoi(argv[++i]);
+			render_every=render_every<1?1:render_every;
+		}
+		else if (strcmp(argv[i], "--output-dir")==0 && i+1<argc){
+			output_dir=argv[++i];
+		}
+		else if (strcmp(argv[i], "--png-threads")==0 && i+1<argc){
+			png_threads=atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--ranks")==0 && i+1<argc){
+			num_ranks=atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--transport")==0 && i+1<argc){
+			rank_sockets = strcmp(argv[++i], "socket")==0;
+		}
+		else if (strcmp(argv[i], "--generations")==0 && i+1<argc){
+			run_generations=atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--board")==0 && i+1<argc){
+			if (sscanf(argv[++i], "%ix%i", &board_option_width, &board_option_height)!=2 || board_option_width<=2*BORDER_WIDTH || board_option_height<=2*BORDER_WIDTH){
+				printUsage(argv[0]);
+				exit(-1);
+			}
+			board_option_set=true;
+		}
+		else{
+			printUsage(argv[0]);
+			exit(-1);
+		}
+	}
+}
 
-	//Take a moment to initialize the OpenCL context as well. This must be done before any memory is allocated
-	ret = clGetPlatformIDs(1, &platform_id, &ret_num_platforms);
-	printf("Num platforms: %i\n", ret_num_platforms);
-	ret = clGetDeviceIDs( platform_id, CL_DEVICE_TYPE_DEFAULT, 1, &device_id, &ret_num_devices);
-	printf("Num devices: %i\n", ret_num_devices);
+bool deviceSupports(cl_device_id device, const char *extension){
+	size_t value_size=0;
+	clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, 0, NULL, &value_size);
+	char *extensions = calloc(value_size+1, 1);
+	clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, value_size, extensions, NULL);
+	bool found = strstr(extensions, extension)!=NULL;
+	free(extensions);
+	return found;
+}
 
+void printDeviceName(const char *label, cl_device_id device){
 	size_t value_size;
-	clGetDeviceInfo(device_id, CL_DEVICE_NAME, 0, NULL, &value_size);
+	clGetDeviceInfo(device, CL_DEVICE_NAME, 0, NULL, &value_size);
 	char *value = malloc(value_size);
-	clGetDeviceInfo(device_id, CL_DEVICE_NAME, value_size, value, NULL);
-	printf("OpenCL Device: %s\n", value);
+	clGetDeviceInfo(device, CL_DEVICE_NAME, value_size, value, NULL);
+	printf("%s%s\n", label, value);
 	free(value);
-	#ifdef __linux__
-	    cl_context_properties cps[] = {
-			CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetGLXContext(window),
-			CL_GLX_DISPLAY_KHR, (cl_context_properties) glfwGetX11Display(),
-	        CL_CONTEXT_PLATFORM, (cl_context_properties)platform_id,
-	        0
-	    };
-	#elif _WIN32
-	    cl_context_properties cps[] = {
-            CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetWGLContext(window),
-            CL_WGL_HDC_KHR, (cl_context_properties)GetDC(glfwGetWin32Window(window)),
-            CL_CONTEXT_PLATFORM, (cl_context_properties)platform_id,
-            0
-		};
-	#endif
-	context = clCreateContextFromType(cps, CL_DEVICE_TYPE_GPU, NULL, NULL, &ret);
-	printf("Context return: %i\n", ret);
+}
 
+void listDevices(){
+	cl_platform_id platforms[MAX_PLATFORMS]; cl_uint num_platforms=0;
+	clGetPlatformIDs(MAX_PLATFORMS, platforms, &num_platforms);
+	for (cl_uint p=0;p<num_platforms;p++){
+		char name[256]={0};
+		clGetPlatformInfo(platforms[p], CL_PLATFORM_NAME, sizeof(name)-1, name, NULL);
+		printf("Platform %u: %s\n", p, name);
+		cl_device_id devices[MAX_DEVICES]; cl_uint num_devices=0;
+		clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, MAX_DEVICES, devices, &num_devices);
+		for (cl_uint d=0;d<num_devices;d++){
+			char label[64]; snprintf(label, sizeof(label), "  Device %u%s: ", d, deviceSupports(devices[d], "cl_khr_gl_sharing")?" (GL sharing)":"");
+			printDeviceName(label, devices[d]);
+		}
+	}
+}
 
- //    glewExperimental = GL_TRUE;
-	// glewInit();
+//Sets platform_id and device_id from --platform and --device
+void selectDevice(){
+	cl_platform_id platforms[MAX_PLATFORMS];
+	ret = clGetPlatformIDs(MAX_PLATFORMS, platforms, &ret_num_platforms);
+	printf("Num platforms: %i\n", ret_num_platforms);
+	if (platform_index>=(int)ret_num_platforms){
+		printf("No platform %i.\n", platform_index);
+		exit(-1);
+	}
+	platform_id = platforms[platform_index];
+	if (device_index<0){
+		ret = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_DEFAULT, 1, &device_id, &ret_num_devices);
+	}
+	else{
+		cl_device_id devices[MAX_DEVICES];
+		ret = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, MAX_DEVICES, devices, &ret_num_devices);
+		if (device_index>=(int)ret_num_devices){
+			printf("No device %i on platform %i.\n", device_index, platform_index);
+			exit(-1);
+		}
+		device_id = devices[device_index];
+	}
+	printf("Num devices: %i\n", ret_num_devices);
+	printDeviceName("OpenCL Device: ", device_id);
+}
 
+//Everything GL needs to draw the board: the quad, the shaders and the board texture. Needs a current context.
+void glSetupBoard(){
 	float board_vertices[32] = {
 	//  Position      Color             		 Texcoords
 	    -1.0f,  1.0f, 0.0f, 255.f, 255.f, 255.f, 0.0f, 0.0f, // Top-left
-	     1.0f,  1.0f, 0.0f, 255.f, 255.f, 255.f, ((float)game_width)/texture_size, 0.0f, // Top-right
-	     1.0f, -1.0f, 0.0f, 255.f, 255.f, 255.f, ((float)game_width)/texture_size, ((float)game_height)/texture_size, // Bottom-right
-	    -1.0f, -1.0f, 0.0f, 255.f, 255.f, 255.f, 0.0f, ((float)game_height)/texture_size  // Bottom-left
+	     1.0f,  1.0f, 0.0f, 255.f, 255.f, 255.f, 1.0f, 0.0f, // Top-right
+	     1.0f, -1.0f, 0.0f, 255.f, 255.f, 255.f, 1.0f, 1.0f, // Bottom-right
+	    -1.0f, -1.0f, 0.0f, 255.f, 255.f, 255.f, 0.0f, 1.0f  // Bottom-left
 	};
 	GLuint board_elements[6] = { //The component triangles of the board
         0, 1, 2,
@@ -315,21 +1002,117 @@ void glInit(){
 	glTexParameteri(BOARD_TEXTURE_TYPE, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(BOARD_TEXTURE_TYPE, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(BOARD_TEXTURE_TYPE, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	char *texInit=malloc(texture_size*texture_size*4); memset(texInit,0,texture_size*texture_size*4);
-	glTexImage2D(BOARD_TEXTURE_TYPE, 0, GL_RGBA8, texture_size, texture_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, texInit);
-	free(texInit);
+	//Exactly the board's size (non-power-of-two textures are core GL), and left uninitialized: every path writes the
+	//whole board into it before it is first drawn
+	glTexImage2D(BOARD_TEXTURE_TYPE, 0, GL_RGBA8, game_width, game_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	glFinish();
 }
 
-void clInit(){
-	//Initialize the CL context to be the same as the GL context
-	
+void glInit(){
+	//Initialization taken from http://www.opengl-tutorial.org/beginners-tutorials/tutorial-1-opening-a-window/
+	if (glfwInit() != GLFW_TRUE){
+		printf("GLFW init failed!");
+		exit(-1);
+	}
 	
 
-	command_queue = clCreateCommandQueueWithProperties(context, device_id, 0, &ret);
-	printf("Command queue return: %i\n", ret);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3); // We want OpenGL 2.1
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+	if (APPLE){
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
+	}
+	glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
+
+	monitor = glfwGetPrimaryMonitor();
+	const GLFWvidmode* monitorInfo = glfwGetVideoMode(monitor);
+	window_width = monitorInfo->width; window_height = monitorInfo->height; //Grab the width of the screen.
+	window = glfwCreateWindow(window_width, window_height, "Conway", NULL, NULL);
+	game_width = window_width; game_height = window_height;
+
+	//glfwWindowHint(GLFW_REFRESH_RATE,2000);
+
+
+
+	if( window == NULL ){
+	    fprintf(stderr, "Failed to open GLFW window.\n" );
+	    glfwTerminate();
+	    exit(-1);
+    }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+
+    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+        printf("Failed to initialize OpenGL context\n");
+        exit(-1);
+    }
+    unsigned const char* device_string = glGetString(GL_RENDERER);
+	printf("OpenGL device: %s\n",device_string);
+	glDisable(GL_DEPTH_TEST); glDisable(GL_MULTISAMPLE);
+
+
+
+
+	//Take a moment to initialize the OpenCL context as well. This must be done before any memory is allocated
+	selectDevice();
+	gl_sharing = !force_no_sharing && deviceSupports(device_id, "cl_khr_gl_sharing");
+	if (gl_sharing){
+		#ifdef __linux__
+		    cl_context_properties cps[] = {
+				CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetGLXContext(window),
+				CL_GLX_DISPLAY_KHR, (cl_context_properties) glfwGetX11Display(),
+		        CL_CONTEXT_PLATFORM, (cl_context_properties)platform_id,
+		        0
+		    };
+		#elif _WIN32
+		    cl_context_properties cps[] = {
+	            CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetWGLContext(window),
+	            CL_WGL_HDC_KHR, (cl_context_properties)GetDC(glfwGetWin32Window(window)),
+	            CL_CONTEXT_PLATFORM, (cl_context_properties)platform_id,
+	            0
+			};
+		#endif
+		context = clCreateContext(cps, 1, &device_id, NULL, NULL, &ret);
+		if (ret!=CL_SUCCESS){ //Typically the selected device is not the one driving the display
+			printf("GL sharing context return: %i, falling back to copies\n", ret);
+			gl_sharing=false;
+		}
+	}
+	if (!gl_sharing){
+		cl_context_properties properties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties)platform_id, 0};
+		context = clCreateContext(properties, 1, &device_id, NULL, NULL, &ret);
+	}
+	printf("GL sharing: %s\n", gl_sharing?"yes":"no");
+	printf("Context return: %i\n", ret);
+
+
+ //    glewExperimental = GL_TRUE;
+	// glewInit();
+	glSetupBoard();
+}
+
+
+//64-bit FNV-1a, continued from hash
+unsigned long long hashBytes(unsigned long long hash, const void *data, size_t length){
+	const unsigned char *bytes = data;
+	for (size_t i=0;i<length;i++){
+		hash^=bytes[i];
+		hash*=0x100000001b3ULL;
+	}
+	return hash;
+}
+
+unsigned long long hashDeviceString(unsigned long long hash, cl_device_id device, cl_device_info param){
+	size_t value_size=0;
+	clGetDeviceInfo(device, param, 0, NULL, &value_size);
+	char *value = calloc(value_size+1, 1);
+	clGetDeviceInfo(device, param, value_size, value, NULL);
+	hash=hashBytes(hash, value, strlen(value)+1);
+	free(value);
+	return hash;
+}
 
-	FILE *fp; fp = fopen("cl_kernel.cl","r");
+char *readSourceFile(const char *path, size_t *length){
+	FILE *fp; fp = fopen(path,"r");
 	if (fp==NULL){
 		printf("Open failed.\n");
 		exit(-1);
@@ -337,46 +1120,2954 @@ void clInit(){
 	char *code_str = (char*)malloc(MAX_SOURCE_SIZE);
 	const size_t code_length = fread(code_str, 1, MAX_SOURCE_SIZE, fp);
 	code_str=realloc(code_str,(code_length+1)*sizeof(char)); code_str[code_length]=0;
-	// printf("Code length: %i\n",(int)code_length);
-	// printf("Code: %s\n", code_str);
 	fclose(fp);
+	*length=code_length;
+	return code_str;
+}
 
-	program = clCreateProgramWithSource(context, 1, (const char **)&code_str, &code_length, &ret);
-	printf("Program create return: %i\n", ret);
-	ret = clBuildProgram(program, 1, &device_id, NULL, NULL, NULL);
-	printf("Program build return: %i\n", ret);
-	free(code_str);
-
-	if(ret != CL_SUCCESS){
-	    size_t len = 0;
-	    clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
-	    char *buffer = calloc(len+1, sizeof(char));
-	    memset(buffer,0,len+1);
-	    ret = clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, len, buffer, NULL);
-	    printf("Build info length: %li. Build info: %s\n", len, &buffer[1]);
-	    // printf("%i %i %i %i %i %i %i %i\n", buffer[0], buffer[1], buffer[2], buffer[3], buffer[4], buffer[5], buffer[6], buffer[7]);
-	    free(buffer);
-	    exit(1);
+//Tries to create and build the program from a cached binary. Returns NULL on any miss or failure.
+cl_program loadCachedProgram(cl_context ctx, cl_device_id device, const char *path, const char *options){
+	FILE *fp = fopen(path, "rb");
+	if (fp==NULL){
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	size_t binary_size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	unsigned char *binary = malloc(binary_size);
+	size_t read = fread(binary, 1, binary_size, fp);
+	fclose(fp);
+	if (read!=binary_size || binary_size==0){
+		free(binary);
+		return NULL;
 	}
 
+	cl_int binary_status; cl_int err;
+	cl_program cached = clCreateProgramWithBinary(ctx, 1, &device, &binary_size, (const unsigned char **)&binary, &binary_status, &err);
+	free(binary);
+	if (err!=CL_SUCCESS || binary_status!=CL_SUCCESS){
+		if (cached!=NULL){
+			clReleaseProgram(cached);
+		}
+		return NULL;
+	}
+	if (clBuildProgram(cached, 1, &device, options, NULL, NULL)!=CL_SUCCESS){ //Driver rejected it (e.g. stale format); rebuild from source
+		clReleaseProgram(cached);
+		return NULL;
+	}
+	return cached;
+}
+
+void storeCachedProgram(cl_program built, const char *path){
+	size_t binary_size=0;
+	if (clGetProgramInfo(built, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binary_size, NULL)!=CL_SUCCESS || binary_size==0){
+		return;
+	}
+	unsigned char *binary = malloc(binary_size);
+	if (clGetProgramInfo(built, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binary, NULL)==CL_SUCCESS){
+		mkdir(BINARY_CACHE_DIR, 0755);
+		char temp_path[256]; snprintf(temp_path, sizeof(temp_path), "%s.%i.tmp", path, (int)getpid());
+		FILE *fp = fopen(temp_path, "wb");
+		if (fp!=NULL){
+			bool written = fwrite(binary, 1, binary_size, fp)==binary_size;
+			written = (fclose(fp)==0) && written;
+			if (written){
+				rename(temp_path, path); //Atomic, so a concurrent launch never sees half a binary
+			}
+			else{
+				remove(temp_path);
+			}
+		}
+	}
+	free(binary);
+}
+
+//Builds cl_kernel.cl for one device, going through the binary cache when it is enabled
+cl_program buildProgram(cl_context ctx, cl_device_id device, const char *options){
+	size_t code_length;
+	char *code_str = readSourceFile("cl_kernel.cl", &code_length);
+
+	char cache_path[256]={0};
+	if (binary_cache_enabled){
+		unsigned long long key = 0xcbf29ce484222325ULL;
+		key=hashDeviceString(key, device, CL_DEVICE_NAME);
+		key=hashDeviceString(key, device, CL_DEVICE_VERSION);
+		key=hashDeviceString(key, device, CL_DRIVER_VERSION);
+		key=hashBytes(key, options?options:"", options?strlen(options)+1:1);
+		key=hashBytes(key, code_str, code_length);
+		snprintf(cache_path, sizeof(cache_path), "%s/%016llx.bin", BINARY_CACHE_DIR, key);
+
+		cl_program cached = loadCachedProgram(ctx, device, cache_path, options);
+		if (cached!=NULL){
+			printf("Program loaded from %s\n", cache_path);
+			free(code_str);
+			return cached;
+		}
+	}
+
+	cl_program built = clCreateProgramWithSource(ctx, 1, (const char **)&code_str, &code_length, &ret);
+	printf("Program create return: %i\n", ret);
+	ret = clBuildProgram(built, 1, &device, options, NULL, NULL);
+	printf("Program build return: %i\n", ret);
+	free(code_str);
+
+	if(ret != CL_SUCCESS){
+	    size_t len = 0;
+	    clGetProgramBuildInfo(built, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
+	    char *buffer = calloc(len+1, sizeof(char));
+	    memset(buffer,0,len+1);
+	    ret = clGetProgramBuildInfo(built, device, CL_PROGRAM_BUILD_LOG, len, buffer, NULL);
+	    printf("Build info length: %li. Build info: %s\n", len, &buffer[1]);
+	    free(buffer);
+	    exit(1);
+	}
+	if (binary_cache_enabled){
+		storeCachedProgram(built, cache_path);
+	}
+	return built;
+}
+
+//Converts one RGBA frame and writes it out. Runs on the writer thread only.
+void writeCaptureFrame(const unsigned char *rgba, unsigned char *scratch){
+	size_t pixels = (size_t)game_width*game_height;
+	if (capture_y4m){ //BT.601 full range, planar 4:4:4
+		for (size_t i=0;i<pixels;i++){
+			float r=rgba[4*i]; float g=rgba[4*i+1]; float b=rgba[4*i+2];
+			scratch[i] = clip(0.299f*r+0.587f*g+0.114f*b, 0, 255);
+			scratch[pixels+i] = clip(128-0.168736f*r-0.331264f*g+0.5f*b, 0, 255);
+			scratch[2*pixels+i] = clip(128+0.5f*r-0.418688f*g-0.081312f*b, 0, 255);
+		}
+		fputs("FRAME\n", capture_file);
+	}
+	else{
+		for (size_t i=0;i<pixels;i++){
+			scratch[3*i]=rgba[4*i]; scratch[3*i+1]=rgba[4*i+1]; scratch[3*i+2]=rgba[4*i+2];
+		}
+	}
+	fwrite(scratch, 3, pixels, capture_file);
+}
+
+void *captureWriter(void *arg){
+	unsigned char *scratch = malloc((size_t)game_width*game_height*3);
+	pthread_mutex_lock(&capture_mutex);
+	while (true){
+		while (capture_queue_count==0 && !capture_stopping){
+			pthread_cond_wait(&capture_cond, &capture_mutex);
+		}
+		if (capture_queue_count==0){
+			break;
+		}
+		char *frame = capture_queue[capture_queue_head];
+		pthread_mutex_unlock(&capture_mutex);
+		writeCaptureFrame((unsigned char*)frame, scratch);
+		pthread_mutex_lock(&capture_mutex);
+		capture_queue_head=(capture_queue_head+1)%CAPTURE_QUEUE;
+		capture_queue_count--;
+	}
+	pthread_mutex_unlock(&capture_mutex);
+	fflush(capture_file);
+	free(scratch);
+	return NULL;
+}
+
+void captureInit(float frame_rate){
+	if (capture_file==NULL){ //Already set up for "-" while parsing arguments
+		capture_file = fopen(capture_path, "wb");
+	}
+	if (capture_file==NULL){
+		printf("Could not open %s for recording.\n", capture_path);
+		exit(-1);
+	}
+	size_t path_length = strlen(capture_path);
+	capture_y4m = path_length>4 && strcmp(capture_path+path_length-4, ".y4m")==0;
+	if (capture_y4m){
+		fprintf(capture_file, "YUV4MPEG2 W%i H%i F%i:1 Ip A1:1 C444\n", game_width, game_height, (int)frame_rate);
+	}
+
+	glGenFramebuffers(1, &capture_fbo);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, capture_fbo);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, BOARD_TEXTURE_TYPE, board_texture, 0);
+	if (glCheckFramebufferStatus(GL_READ_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE){
+		printf("Capture framebuffer incomplete.\n");
+		exit(-1);
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	size_t frame_size = (size_t)game_width*game_height*4;
+	glGenBuffers(CAPTURE_PBOS, capture_pbos);
+	for (int i=0;i<CAPTURE_PBOS;i++){
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, capture_pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, frame_size, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	for (int i=0;i<CAPTURE_QUEUE;i++){
+		capture_queue[i]=malloc(frame_size);
+	}
+	pthread_create(&capture_thread, NULL, captureWriter, NULL);
+}
+
+//Maps every pending PBO whose readback has finished, oldest first, and queues it for the writer. With wait set, blocks until all are done.
+void captureDrain(bool wait){
+	size_t frame_size = (size_t)game_width*game_height*4;
+	while (capture_pending_pbos>0){
+		int oldest = (capture_next_pbo-capture_pending_pbos+CAPTURE_PBOS)%CAPTURE_PBOS;
+		GLenum status = glClientWaitSync(capture_fences[oldest], wait?GL_SYNC_FLUSH_COMMANDS_BIT:0, wait?GL_TIMEOUT_IGNORED:0);
+		if (status!=GL_ALREADY_SIGNALED && status!=GL_CONDITION_SATISFIED){
+			return;
+		}
+		glDeleteSync(capture_fences[oldest]);
+		capture_pending_pbos--;
+
+		pthread_mutex_lock(&capture_mutex);
+		bool full = capture_queue_count==CAPTURE_QUEUE;
+		char *slot = full?NULL:capture_queue[(capture_queue_head+capture_queue_count)%CAPTURE_QUEUE];
+		pthread_mutex_unlock(&capture_mutex);
+		if (full){ //Writer is behind; drop rather than stall the loop
+			frames_dropped++;
+			continue;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, capture_pbos[oldest]);
+		void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame_size, GL_MAP_READ_BIT);
+		if (mapped!=NULL){
+			memcpy(slot, mapped, frame_size);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			pthread_mutex_lock(&capture_mutex);
+			capture_queue_count++;
+			pthread_cond_signal(&capture_cond);
+			pthread_mutex_unlock(&capture_mutex);
+			frames_captured++;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+}
+
+//Starts an asynchronous readback of the current board texture
+void captureBoard(){
+	captureDrain(false);
+	if (capture_pending_pbos==CAPTURE_PBOS){ //Every PBO is still in flight
+		frames_dropped++;
+		return;
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, capture_fbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, capture_pbos[capture_next_pbo]);
+	glReadPixels(0, 0, game_width, game_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	capture_fences[capture_next_pbo] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	capture_next_pbo=(capture_next_pbo+1)%CAPTURE_PBOS;
+	capture_pending_pbos++;
+}
+
+void captureFinish(){
+	captureDrain(true);
+	pthread_mutex_lock(&capture_mutex);
+	capture_stopping=true;
+	pthread_cond_signal(&capture_cond);
+	pthread_mutex_unlock(&capture_mutex);
+	pthread_join(capture_thread, NULL);
+	fclose(capture_file);
+	fprintf(stderr, "Recorded %li frames, dropped %li\n", frames_captured, frames_dropped);
+}
+
+void clInit(){
+	//Initialize the CL context to be the same as the GL context
+	
+	
+
+	cl_queue_properties profiling_properties[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+	command_queue = clCreateCommandQueueWithProperties(context, device_id, profiling_enabled?profiling_properties:NULL, &ret);
+	printf("Command queue return: %i\n", ret);
+
+	program = buildProgram(context, device_id, program_options);
+
+	calculateAdjacencies = clCreateKernel(program, "compute_adjacencies", &ret);
+	zeroAdjacencies = clCreateKernel(program, "zero_adjacencies", &ret);
+	updateState = clCreateKernel(program, "compute_state", &ret);
+	updateStateHeat = clCreateKernel(program, "compute_state_heat", &ret);
+	decayHeat = clCreateKernel(program, "decay_heat", &ret);
+	writeStateToImage = clCreateKernel(program, "write_state_to_image", &ret);
+	//printf("Write state kernel return: %i\n",ret);
+	initializeState = clCreateKernel(program, "initialize_state", &ret);
+	//printf ("Initialize state kernel return %i\n", ret);
+	flipSquare = clCreateKernel(program, "flip_square", &ret);
+	stepImage = clCreateKernel(program, "step_image", &ret);
+	tileState = clCreateKernel(program, "tile_state", &ret);
+	untileState = clCreateKernel(program, "untile_state", &ret);
+	stepTiled = clCreateKernel(program, "step_tiled", &ret);
+	fillRandom = clCreateKernel(program, "fill_random", &ret);
+	packDelta = clCreateKernel(program, "pack_delta", &ret);
+	unpackState = clCreateKernel(program, "unpack_state", &ret);
+	countWords = clCreateKernel(program, "count_words", &ret);
+	scanCounts = clCreateKernel(program, "scan_counts", &ret);
+	compactWords = clCreateKernel(program, "compact_words", &ret);
+
+	if (!gl_sharing){ //The board is read back instead
+		writeStateToPixels = clCreateKernel(program, "write_state_to_pixels", &ret);
+		return;
+	}
+	CL_board_texture=clCreateFromGLTexture(context, CL_MEM_READ_WRITE, BOARD_TEXTURE_TYPE, 0, board_texture, &ret);  //Should be able to change this to WRITE_ONLY later -- just READ_WRITE for debug
+	printf("Texture grab return: %i\n", ret);
+}	
+
+void glSyncInit(){
+	if (!gl_sharing || force_no_gl_sync || !deviceSupports(device_id, "cl_khr_gl_event")){
+		printf("GL/CL sync: glFinish/clFinish\n");
+		return;
+	}
+	createEventFromGLsync = clGetExtensionFunctionAddressForPlatform(platform_id, "clCreateEventFromGLsyncKHR");
+	gl_event_sync = createEventFromGLsync!=NULL;
+	if (glfwExtensionSupported("GL_ARB_cl_event")){
+		createSyncFromCLevent = (GLsync (APIENTRY *)(struct _cl_context *, struct _cl_event *, GLbitfield))glfwGetProcAddress("glCreateSyncFromCLeventARB");
+	}
+	printf("GL/CL sync: %s%s\n", gl_event_sync?"cl_khr_gl_event":"glFinish/clFinish", gl_event_sync && createSyncFromCLevent!=NULL?" + GL_ARB_cl_event":"");
+}
+
+//Picks the devices slabs run on: every device on the platform with --slabs all, otherwise equal sub-devices of the
+//first device that can be partitioned num_slabs ways. Falls back to sharing whatever devices exist round-robin.
+int findSlabDevices(cl_device_id *devices){
+	cl_uint num_devices=0;
+	cl_device_id platform_devices[MAX_SLABS];
+	clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, MAX_SLABS, platform_devices, &num_devices);
+	num_devices = num_devices>MAX_SLABS?MAX_SLABS:num_devices; //The count is the platform's, only MAX_SLABS were returned
+	if (num_devices==0){
+		printf("No OpenCL devices for slab mode.\n");
+		exit(-1);
+	}
+	if (slabs_all_devices){
+		num_slabs=num_devices;
+		memcpy(devices, platform_devices, num_devices*sizeof(cl_device_id));
+		return num_devices;
+	}
+	for (cl_uint d=0;d<num_devices;d++){
+		cl_uint max_sub_devices=0; cl_uint compute_units=0;
+		clGetDeviceInfo(platform_devices[d], CL_DEVICE_PARTITION_MAX_SUB_DEVICES, sizeof(cl_uint), &max_sub_devices, NULL);
+		clGetDeviceInfo(platform_devices[d], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &compute_units, NULL);
+		if (max_sub_devices<(cl_uint)num_slabs || compute_units<(cl_uint)num_slabs){
+			continue;
+		}
+		cl_device_partition_property partition[] = {CL_DEVICE_PARTITION_EQUALLY, compute_units/num_slabs, 0};
+		cl_uint num_sub_devices=0;
+		if (clCreateSubDevices(platform_devices[d], partition, MAX_SLABS, devices, &num_sub_devices)==CL_SUCCESS && num_sub_devices>=(cl_uint)num_slabs){
+			printf("Slabs use %i sub-devices of %u compute units each\n", num_slabs, compute_units/num_slabs);
+			return num_sub_devices>MAX_SLABS?MAX_SLABS:num_sub_devices;
+		}
+	}
+	memcpy(devices, platform_devices, num_devices*sizeof(cl_device_id));
+	return num_devices;
+}
+
+void slabInit(){
+	cl_device_id devices[MAX_SLABS];
+	int num_devices = findSlabDevices(devices);
+	if (num_slabs>MAX_SLABS || game_height/num_slabs<2){
+		printf("Too many slabs for the board.\n");
+		exit(-1);
+	}
+	cl_device_id context_devices[MAX_SLABS]; int num_context_devices = num_devices<num_slabs?num_devices:num_slabs;
+	memcpy(context_devices, devices, num_context_devices*sizeof(cl_device_id));
+	cl_context_properties properties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties)platform_id, 0};
+	slab_context = clCreateContext(properties, num_context_devices, context_devices, NULL, NULL, &ret);
+	printf("Slab context return: %i (%i slabs on %i devices)\n", ret, num_slabs, num_context_devices);
+
+	int border_width = BORDER_WIDTH;
+	int first_row=0;
+	for (int i=0;i<num_slabs;i++){
+		slab *sl = &slabs[i];
+		sl->device = context_devices[i%num_context_devices];
+		sl->first_row = first_row;
+		sl->rows = game_height/num_slabs + (i<game_height%num_slabs);
+		first_row += sl->rows;
+
+		sl->compute_queue = clCreateCommandQueueWithProperties(slab_context, sl->device, NULL, &ret);
+		sl->transfer_queue = clCreateCommandQueueWithProperties(slab_context, sl->device, NULL, &ret);
+		sl->program = buildProgram(slab_context, sl->device, program_options);
+		sl->step_rows = clCreateKernel(sl->program, "step_rows", &ret);
+		sl->initialize_slab = clCreateKernel(sl->program, "initialize_slab", &ret);
+		sl->flip = clCreateKernel(sl->program, "flip_square", &ret);
+		sl->fill = clCreateKernel(sl->program, "fill_random", &ret);
+
+		size_t slab_size = (size_t)(sl->rows+2)*game_width;
+		for (int j=0;j<2;j++){
+			sl->state[j] = clCreateBuffer(slab_context, CL_MEM_READ_WRITE, slab_size, NULL, &ret);
+		}
+		printf("Slab %i: rows %i-%i, buffer creation: %i\n", i, sl->first_row, sl->first_row+sl->rows-1, ret);
+		clEnqueueMigrateMemObjects(sl->compute_queue, 2, sl->state, CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED, 0, NULL, NULL); //Place them on the owning device up front
+
+		clSetKernelArg(sl->initialize_slab, 1, sizeof(border_width), &border_width);
+		clSetKernelArg(sl->initialize_slab, 2, sizeof(game_width), &game_width);
+		clSetKernelArg(sl->initialize_slab, 3, sizeof(game_height), &game_height);
+		clSetKernelArg(sl->initialize_slab, 4, sizeof(sl->first_row), &sl->first_row);
+		clSetKernelArg(sl->step_rows, 2, sizeof(game_width), &game_width);
+		clSetKernelArg(sl->flip, 3, sizeof(game_width), &game_width);
+		int halo_row = sl->first_row-1;
+		clSetKernelArg(sl->fill, 1, sizeof(game_width), &game_width);
+		clSetKernelArg(sl->fill, 8, sizeof(halo_row), &halo_row);
+	}
+	slab_host_board = malloc((size_t)game_width*game_height);
+}
+
+void slabClear(){
+	for (int i=0;i<num_slabs;i++){
+		slab *sl = &slabs[i];
+		size_t slab_size = (size_t)(sl->rows+2)*game_width;
+		for (int j=0;j<2;j++){
+			clSetKernelArg(sl->initialize_slab, 0, sizeof(cl_mem), &sl->state[j]);
+			clEnqueueNDRangeKernel(sl->compute_queue, sl->initialize_slab, 1, NULL, &slab_size, NULL, 0, NULL, NULL);
+		}
+	}
+	for (int i=0;i<num_slabs;i++){ //The initialized halos are already correct, so nothing is pending
+		clFinish(slabs[i].compute_queue); clFinish(slabs[i].transfer_queue);
+		for (int k=0;k<2;k++){
+			if (slabs[i].halo_ready[k]!=NULL){
+				clReleaseEvent(slabs[i].halo_ready[k]);
+				slabs[i].halo_ready[k]=NULL;
+			}
+		}
+	}
+	board_behind=true;
+}
+
+//Advances every slab one generation. The first and last owned rows are computed first so the halo copies to the
+//neighbours can start while the interior rows are still being computed.
+void slabStep(){
+	int next = 1-slab_current;
+	for (int i=0;i<num_slabs;i++){
+		slab *sl = &slabs[i];
+		cl_event waits[2]; cl_uint num_waits=0;
+		for (int k=0;k<2;k++){
+			if (sl->halo_ready[k]!=NULL){
+				waits[num_waits++]=sl->halo_ready[k];
+			}
+		}
+		clSetKernelArg(sl->step_rows, 0, sizeof(cl_mem), &sl->state[slab_current]);
+		clSetKernelArg(sl->step_rows, 1, sizeof(cl_mem), &sl->state[next]);
+		size_t row_size[2]={game_width, 1};
+		int top=1; int bottom=sl->rows;
+		clSetKernelArg(sl->step_rows, 3, sizeof(int), &top);
+		clEnqueueNDRangeKernel(sl->compute_queue, sl->step_rows, 2, NULL, row_size, NULL, num_waits, waits, NULL);
+		clSetKernelArg(sl->step_rows, 3, sizeof(int), &bottom);
+		clEnqueueNDRangeKernel(sl->compute_queue, sl->step_rows, 2, NULL, row_size, NULL, 0, NULL, &sl->boundary_done);
+		if (sl->rows>2){
+			int interior=2; size_t interior_size[2]={game_width, sl->rows-2};
+			clSetKernelArg(sl->step_rows, 3, sizeof(int), &interior);
+			clEnqueueNDRangeKernel(sl->compute_queue, sl->step_rows, 2, NULL, interior_size, NULL, 0, NULL, NULL);
+		}
+		clFlush(sl->compute_queue);
+		for (int k=0;k<2;k++){
+			if (sl->halo_ready[k]!=NULL){
+				clReleaseEvent(sl->halo_ready[k]);
+				sl->halo_ready[k]=NULL;
+			}
+		}
+	}
+	//Copying into a slab's halo also has to wait for that slab's own boundary rows, since those read the previous halo
+	for (int i=0;i<num_slabs;i++){
+		slab *sl = &slabs[i];
+		if (i>0){
+			slab *above = &slabs[i-1];
+			cl_event waits[2]={above->boundary_done, sl->boundary_done};
+			clEnqueueCopyBuffer(sl->transfer_queue, above->state[next], sl->state[next], (size_t)above->rows*game_width, 0, game_width, 2, waits, &sl->halo_ready[0]);
+		}
+		if (i<num_slabs-1){
+			slab *below = &slabs[i+1];
+			cl_event waits[2]={below->boundary_done, sl->boundary_done};
+			clEnqueueCopyBuffer(sl->transfer_queue, below->state[next], sl->state[next], game_width, (size_t)(sl->rows+1)*game_width, game_width, 2, waits, &sl->halo_ready[1]);
+		}
+		clFlush(sl->transfer_queue);
+	}
+	for (int i=0;i<num_slabs;i++){
+		clReleaseEvent(slabs[i].boundary_done);
+	}
+	slab_current=next;
+	board_behind=true;
+}
+
+//Flips a cell in the owning slab, and in the neighbour's halo copy of it if it sits on a slab edge
+void slabFlip(int x, int y){
+	const size_t one[1]={1};
+	//A boundary row may still be being copied into a neighbour's halo, so its owner flips only after that copy, and the
+	//halo flip below then lands on top of the copied row
+	cl_event copies[2]; cl_uint num_copies=0;
+	for (int i=0;i<num_slabs;i++){
+		int local_y = y-slabs[i].first_row+1;
+		int k = local_y==0?0:local_y==slabs[i].rows+1?1:-1;
+		if (k>=0 && slabs[i].halo_ready[k]!=NULL){
+			copies[num_copies]=slabs[i].halo_ready[k];
+			clRetainEvent(copies[num_copies++]);
+		}
+	}
+	for (int i=0;i<num_slabs;i++){
+		slab *sl = &slabs[i];
+		int local_y = y-sl->first_row+1;
+		if (local_y<0 || local_y>sl->rows+1){
+			continue;
+		}
+		bool owner = local_y>=1 && local_y<=sl->rows;
+		clSetKernelArg(sl->flip, 0, sizeof(cl_mem), &sl->state[slab_current]);
+		clSetKernelArg(sl->flip, 1, sizeof(x), &x);
+		clSetKernelArg(sl->flip, 2, sizeof(local_y), &local_y);
+		if (owner){
+			clEnqueueNDRangeKernel(sl->compute_queue, sl->flip, 1, NULL, one, one, num_copies, num_copies>0?copies:NULL, NULL);
+			clFlush(sl->compute_queue);
+		}
+		else{ //Halo row: order after the pending halo copy and make the next step wait on the flip instead
+			int k = local_y==0?0:1;
+			cl_event copied = sl->halo_ready[k];
+			clEnqueueNDRangeKernel(sl->transfer_queue, sl->flip, 1, NULL, one, one, copied!=NULL, copied!=NULL?&copied:NULL, &sl->halo_ready[k]);
+			if (copied!=NULL){
+				clReleaseEvent(copied);
+			}
+			clFlush(sl->transfer_queue);
+		}
+	}
+	for (cl_uint i=0;i<num_copies;i++){
+		clReleaseEvent(copies[i]);
+	}
+	board_behind=true;
+}
+void slabGather(){
+	for (int i=0;i<num_slabs;i++){
+		slab *sl = &slabs[i];
+		clEnqueueReadBuffer(sl->compute_queue, sl->state[slab_current], CL_FALSE, game_width, (size_t)sl->rows*game_width, slab_host_board+(size_t)sl->first_row*game_width, 0, NULL, NULL);
+	}
+	for (int i=0;i<num_slabs;i++){
+		clFinish(slabs[i].compute_queue);
+	}
+	clEnqueueWriteBuffer(command_queue, game_state, CL_FALSE, 0, (size_t)game_width*game_height, slab_host_board, 0, NULL, NULL);
+}
+
+//Brings game_state up to the newest generation before something reads it: a draw, an edit or a history record.
+//Engines that keep the board elsewhere only set board_behind, so frames that are not drawn never copy it back.
+void syncBoard(){
+	if (!board_behind){
+		return;
+	}
+	if (num_slabs>0){
+		slabGather();
+	}
+	else if (image_engine){
+		size_t origin[3]={0,0,0}; size_t region[3]={game_width, game_height, 1};
+		ret = clEnqueueCopyImageToBuffer(command_queue, state_images[image_current], game_state, origin, region, 0, 0, NULL, profileEvent(PROFILE_BOARD_COPY));
+	}
+	else if (tiled_engine){
+		size_t board[2]={game_width, game_height};
+		ret = clSetKernelArg(untileState, 0, sizeof(cl_mem), &state_tiles[tiles_current]);
+		ret = clEnqueueNDRangeKernel(command_queue, untileState, 2, NULL, board, NULL, 0, NULL, profileEvent(PROFILE_BOARD_COPY));
+	}
+	board_behind=false;
+}
+
+double monotonicSeconds(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+void sleepUntil(double deadline){
+	double wake = deadline-PACING_SPIN_TAIL;
+	if (wake>monotonicSeconds()){
+		struct timespec ts;
+		ts.tv_sec=(time_t)wake; ts.tv_nsec=(long)((wake-ts.tv_sec)*1e9);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)==EINTR){}
+	}
+	while (monotonicSeconds()<deadline){}
+}
+
+//Philox4x32-10, identical to philox() in cl_kernel.cl
+void philox(cl_uint counter[4], cl_ulong seed){
+	cl_uint key[2] = {(cl_uint)seed, (cl_uint)(seed>>32)};
+	for (int r=0;r<10;r++){
+		cl_ulong product0 = (cl_ulong)0xD2511F53u*counter[0]; cl_ulong product1 = (cl_ulong)0xCD9E8D57u*counter[2];
+		cl_uint next[4] = {(cl_uint)(product1>>32)^counter[1]^key[0], (cl_uint)product1, (cl_uint)(product0>>32)^counter[3]^key[1], (cl_uint)product0};
+		memcpy(counter, next, sizeof(next));
+		key[0]+=0x9E3779B9u; key[1]+=0xBB67AE85u;
+	}
+}
+
+cl_ulong densityThreshold(float density){
+	return density<=0?0:density>=1?((cl_ulong)1<<32):(cl_ulong)(density*4294967296.0);
+}
+
+//Host version of fill_random for one cell. Stream 0 is the starting soup, so a distributed run matches a headless one
+//regardless of the rank count.
+char soupCell(int x, int y, cl_uint stream){
+	cl_uint counter[4] = {(cl_uint)x, (cl_uint)y, stream, 0};
+	philox(counter, soup_seed);
+	return counter[0]<densityThreshold(soup_density);
+}
+
+//fill_random for slab mode. Each slab fills its own rows of the rectangle and its halo rows, which come out the same as
+//the neighbour's rows because a cell only depends on its position. The fill waits for the halo copies into the slab and
+//out of its boundary rows, and stands in for the halo copies from then on, so steps and halo flips come after it.
+void slabFillRandom(int x0, int y0, int width, int height, cl_uint stream){
+	int x1 = x0+width<game_width?x0+width:game_width; int y1 = y0+height<game_height?y0+height:game_height;
+	x0 = x0<0?0:x0; y0 = y0<0?0:y0;
+	if (x1<=x0 || y1<=y0){
+		return;
+	}
+	cl_uint seed_lo = soup_seed; cl_uint seed_hi = soup_seed>>32;
+	cl_ulong threshold = densityThreshold(soup_density);
+	for (int i=0;i<num_slabs;i++){
+		slab *sl = &slabs[i];
+		int top = y0>sl->first_row-1?y0:sl->first_row-1;
+		int bottom = y1<sl->first_row+sl->rows+1?y1:sl->first_row+sl->rows+1;
+		if (bottom<=top){
+			continue;
+		}
+		cl_event copies[4]={sl->halo_ready[0], sl->halo_ready[1], i>0?slabs[i-1].halo_ready[1]:NULL, i<num_slabs-1?slabs[i+1].halo_ready[0]:NULL};
+		cl_event waits[4]; cl_uint num_waits=0;
+		for (int k=0;k<4;k++){
+			if (copies[k]!=NULL){
+				waits[num_waits++]=copies[k];
+			}
+		}
+		clSetKernelArg(sl->fill, 0, sizeof(cl_mem), &sl->state[slab_current]);
+		clSetKernelArg(sl->fill, 2, sizeof(x0), &x0);
+		clSetKernelArg(sl->fill, 3, sizeof(top), &top);
+		clSetKernelArg(sl->fill, 4, sizeof(seed_lo), &seed_lo);
+		clSetKernelArg(sl->fill, 5, sizeof(seed_hi), &seed_hi);
+		clSetKernelArg(sl->fill, 6, sizeof(stream), &stream);
+		clSetKernelArg(sl->fill, 7, sizeof(threshold), &threshold);
+		size_t global[2]={x1-x0, bottom-top};
+		cl_event filled;
+		clEnqueueNDRangeKernel(sl->compute_queue, sl->fill, 2, NULL, global, NULL, num_waits, num_waits>0?waits:NULL, &filled);
+		clFlush(sl->compute_queue);
+		for (int k=0;k<2;k++){
+			if (sl->halo_ready[k]!=NULL){
+				clReleaseEvent(sl->halo_ready[k]);
+			}
+			clRetainEvent(filled);
+			sl->halo_ready[k]=filled;
+		}
+		clReleaseEvent(filled);
+	}
+	board_behind=true;
+}
+
+void CL_CALLBACK simMarkerDone(cl_event event, cl_int status, void *time){
+	double now = monotonicSeconds();
+	pthread_mutex_lock(&sim_timing_mutex);
+	*(double *)time = now;
+	pthread_mutex_unlock(&sim_timing_mutex);
+}
+
+//Puts a marker on queue that notes in *time when everything before it has completed
+void enqueueSimMarker(cl_command_queue queue, double *time){
+	cl_event marker;
+	*time=0;
+	if (clEnqueueMarkerWithWaitList(queue, 0, NULL, &marker)==CL_SUCCESS){
+		clSetEventCallback(marker, CL_COMPLETE, simMarkerDone, time);
+		clReleaseEvent(marker); //The callback still runs
+	}
+}
+
+//Takes the sample of the last timed frame into sim_cost once both of its markers have completed
+void collectSimCost(){
+	if (sim_timing_generations==0){
+		return;
+	}
+	pthread_mutex_lock(&sim_timing_mutex);
+	double start=sim_timing_start; double end=sim_timing_end;
+	pthread_mutex_unlock(&sim_timing_mutex);
+	if (start==0 || end==0){
+		return;
+	}
+	double sample = (end-start)/sim_timing_generations;
+	sim_cost = sim_cost==0?sample:sim_cost+COST_SMOOTHING*(sample-sim_cost);
+	sim_timing_generations=0;
+}
+
+//Run time of a finished profiled command. The caller still owns the event; NULL (a failed enqueue) counts as 0.
+double eventSeconds(cl_event event){
+	cl_ulong start, end;
+	if (event==NULL || clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL)!=CL_SUCCESS ||
+	    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL)!=CL_SUCCESS){
+		return 0;
+	}
+	return (end-start)*1e-9;
+}
+
+//Full-duplex swap of one row with a neighbour over a non-blocking socket
+//Stops a rank whose parent has gone, so it does not wait forever on neighbours that were killed with it
+void checkRankParent(){
+	if (getppid()!=rank_parent){
+		_exit(-1);
+	}
+}
+
+void exchangeRows(int fd, const char *out, char *in, size_t length){
+	size_t sent=0; size_t received=0;
+	while (sent<length || received<length){
+		struct pollfd p = {fd, (sent<length?POLLOUT:0)|(received<length?POLLIN:0), 0};
+		if (poll(&p, 1, RANK_POLL_MS)==0){
+			checkRankParent();
+			continue;
+		}
+		if (p.revents&POLLOUT){
+			ssize_t k = write(fd, out+sent, length-sent);
+			sent += k>0?k:0;
+		}
+		if (p.revents&POLLIN){
+			ssize_t k = read(fd, in+received, length-received);
+			if (k==0){
+				printf("Rank neighbour closed its socket.\n");
+				exit(-1);
+			}
+			received += k>0?k:0;
+		}
+		else if (p.revents&(POLLERR|POLLHUP)){
+			printf("Rank socket error.\n");
+			exit(-1);
+		}
+	}
+}
+
+//Slot for one published halo row: [rank][generation parity][top/bottom]
+char *rankSlot(char *slots, int rank, long generation, int side){
+	return slots+(((size_t)rank*2+generation%2)*2+side)*board_option_width;
+}
+
+void waitForPublished(long *published, long generation){
+	for (long spins=1;__atomic_load_n(published, __ATOMIC_ACQUIRE)<generation;spins++){
+		if (spins%4096==0){
+			checkRankParent();
+		}
+		sched_yield();
+	}
+}
+
+void runRank(int rank, rank_shared *shared, char *slots, int socket_up, int socket_down){
+	int width = board_option_width;
+	int first_row = rank*(board_option_height/num_ranks) + (rank<board_option_height%num_ranks?rank:board_option_height%num_ranks);
+	int rows = board_option_height/num_ranks + (rank<board_option_height%num_ranks);
+	rank_timing *timing = &shared[rank].timing;
+	timing->rows = rows;
+
+	cl_platform_id rank_platform; cl_device_id devices[MAX_RANKS]; cl_uint num_devices=0;
+	cl_platform_id platforms[MAX_PLATFORMS]; cl_uint num_platforms=0;
+	clGetPlatformIDs(MAX_PLATFORMS, platforms, &num_platforms);
+	if (platform_index>=(int)num_platforms){
+		printf("Rank %i: no platform %i.\n", rank, platform_index);
+		exit(-1);
+	}
+	rank_platform = platforms[platform_index];
+	clGetDeviceIDs(rank_platform, CL_DEVICE_TYPE_ALL, MAX_RANKS, devices, &num_devices);
+	if (num_devices==0){
+		printf("Rank %i: no OpenCL devices.\n", rank);
+		exit(-1);
+	}
+	cl_device_id device = devices[rank%num_devices];
+	cl_context_properties properties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties)rank_platform, 0};
+	cl_int err;
+	cl_context rank_context = clCreateContext(properties, 1, &device, NULL, NULL, &err);
+	cl_queue_properties queue_properties[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+	cl_command_queue queue = clCreateCommandQueueWithProperties(rank_context, device, queue_properties, &err);
+	cl_program rank_program = buildProgram(rank_context, device, program_options);
+	cl_kernel step = clCreateKernel(rank_program, "step_rows", &err);
+	clSetKernelArg(step, 2, sizeof(width), &width);
+
+	size_t slab_size = (size_t)(rows+2)*width;
+	char *initial = malloc(slab_size);
+	for (int local_y=0;local_y<rows+2;local_y++){
+		int y = first_row-1+local_y;
+		for (int x=0;x<width;x++){
+			bool border = y<BORDER_WIDTH || y>=board_option_height-BORDER_WIDTH || x<BORDER_WIDTH || x>=width-BORDER_WIDTH;
+			initial[(size_t)local_y*width+x] = border?2:soupCell(x, y, 0);
+		}
+	}
+	cl_mem state[2];
+	state[0] = clCreateBuffer(rank_context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, slab_size, initial, &err);
+	state[1] = clCreateBuffer(rank_context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, slab_size, initial, &err); //Carries the fixed border halos of the outer ranks
+	if (err!=CL_SUCCESS){
+		printf("Rank %i: buffer creation failed (%i)\n", rank, err);
+		exit(-1);
+	}
+
+	char *top = malloc(width); char *bottom = malloc(width);
+	char *halo_above = malloc(width); char *halo_below = malloc(width);
+	cl_event interior_done=NULL;
+	double start_time = monotonicSeconds();
+	for (long g=0;g<run_generations;g++){
+		cl_mem src = state[g%2]; cl_mem dst = state[1-g%2];
+		clSetKernelArg(step, 0, sizeof(cl_mem), &src);
+		clSetKernelArg(step, 1, sizeof(cl_mem), &dst);
+
+		//Boundary rows first and read back, then the interior runs while the halos are exchanged
+		cl_event top_done, bottom_done, read_done;
+		size_t row_size[2]={width, 1};
+		int top_row=1; int bottom_row=rows;
+		clSetKernelArg(step, 3, sizeof(int), &top_row);
+		clEnqueueNDRangeKernel(queue, step, 2, NULL, row_size, NULL, 0, NULL, &top_done);
+		clSetKernelArg(step, 3, sizeof(int), &bottom_row);
+		clEnqueueNDRangeKernel(queue, step, 2, NULL, row_size, NULL, 0, NULL, &bottom_done);
+		clEnqueueReadBuffer(queue, dst, CL_FALSE, (size_t)width, width, top, 0, NULL, NULL);
+		clEnqueueReadBuffer(queue, dst, CL_FALSE, (size_t)rows*width, width, bottom, 0, NULL, &read_done);
+		cl_event previous_interior = interior_done; interior_done=NULL;
+		if (rows>2){
+			int interior_row=2; size_t interior_size[2]={width, rows-2};
+			clSetKernelArg(step, 3, sizeof(int), &interior_row);
+			clEnqueueNDRangeKernel(queue, step, 2, NULL, interior_size, NULL, 0, NULL, &interior_done);
+		}
+		clFlush(queue);
+
+		double wait_start = monotonicSeconds();
+		clWaitForEvents(1, &read_done);
+		clReleaseEvent(read_done);
+		timing->compute += eventSeconds(top_done)+eventSeconds(bottom_done);
+		clReleaseEvent(top_done); clReleaseEvent(bottom_done);
+		if (previous_interior!=NULL){ //In-order queue, so it finished before read_done
+			timing->compute += eventSeconds(previous_interior);
+			clReleaseEvent(previous_interior);
+		}
+		double exchange_start = monotonicSeconds();
+		timing->boundary_wait += exchange_start-wait_start;
+
+		if (rank_sockets){
+			if (socket_up>=0){
+				exchangeRows(socket_up, top, halo_above, width);
+			}
+			if (socket_down>=0){
+				exchangeRows(socket_down, bottom, halo_below, width);
+			}
+		}
+		else{
+			if (rank>0){
+				memcpy(rankSlot(slots, rank, g, 0), top, width);
+				__atomic_store_n(&shared[rank].published[0], g+1, __ATOMIC_RELEASE);
+			}
+			if (rank<num_ranks-1){
+				memcpy(rankSlot(slots, rank, g, 1), bottom, width);
+				__atomic_store_n(&shared[rank].published[1], g+1, __ATOMIC_RELEASE);
+			}
+			if (rank>0){
+				waitForPublished(&shared[rank-1].published[1], g+1);
+				memcpy(halo_above, rankSlot(slots, rank-1, g, 1), width);
+			}
+			if (rank<num_ranks-1){
+				waitForPublished(&shared[rank+1].published[0], g+1);
+				memcpy(halo_below, rankSlot(slots, rank+1, g, 0), width);
+			}
+		}
+		timing->halo_wait += monotonicSeconds()-exchange_start;
+
+		//In-order queue: these land after the interior update, and before the next generation reads them
+		if (rank>0){
+			clEnqueueWriteBuffer(queue, dst, CL_FALSE, 0, width, halo_above, 0, NULL, NULL);
+			timing->halo_bytes += width;
+		}
+		if (rank<num_ranks-1){
+			clEnqueueWriteBuffer(queue, dst, CL_FALSE, (size_t)(rows+1)*width, width, halo_below, 0, NULL, NULL);
+			timing->halo_bytes += width;
+		}
+	}
+	clFinish(queue);
+	if (interior_done!=NULL){
+		timing->compute += eventSeconds(interior_done);
+		clReleaseEvent(interior_done);
+	}
+	timing->wall = monotonicSeconds()-start_time;
+
+	clEnqueueReadBuffer(queue, state[run_generations%2], CL_TRUE, 0, slab_size, initial, 0, NULL, NULL);
+	for (size_t i=width;i<(size_t)(rows+1)*width;i++){
+		timing->population += initial[i]==1;
+	}
+	free(initial); free(top); free(bottom); free(halo_above); free(halo_below);
+}
+
+//Forks num_ranks processes, waits for them and prints the per-rank timing breakdown
+void runDistributed(){
+	if (num_ranks>MAX_RANKS || board_option_height/num_ranks<2){
+		printf("Too many ranks for the board.\n");
+		exit(-1);
+	}
+	size_t segment_size = num_ranks*sizeof(rank_shared) + (size_t)num_ranks*4*board_option_width;
+	char name[64]; snprintf(name, sizeof(name), "/conway-%i", (int)getpid());
+	int fd = shm_open(name, O_CREAT|O_EXCL|O_RDWR, 0600);
+	if (fd<0 || ftruncate(fd, segment_size)!=0){
+		printf("Shared memory segment creation failed.\n");
+		exit(-1);
+	}
+	void *segment = mmap(NULL, segment_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	shm_unlink(name); //The mapping is inherited by the ranks, the name is not needed any more
+	memset(segment, 0, segment_size);
+	rank_shared *shared = segment;
+	char *slots = (char*)segment+num_ranks*sizeof(rank_shared);
+
+	int sockets[MAX_RANKS][2]; //[r] connects rank r (end 0) to rank r+1 (end 1)
+	for (int r=0;r<num_ranks-1 && rank_sockets;r++){
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets[r])!=0){
+			printf("Socket pair creation failed.\n");
+			exit(-1);
+		}
+		fcntl(sockets[r][0], F_SETFL, O_NONBLOCK); fcntl(sockets[r][1], F_SETFL, O_NONBLOCK);
+	}
+
+	printf("Distributed run: %ix%i board, %i ranks, %i generations over %s\n", board_option_width, board_option_height, num_ranks, run_generations, rank_sockets?"Unix sockets":"shared memory");
+	fflush(stdout);
+	rank_parent=getpid();
+	pid_t ranks[MAX_RANKS];
+	for (int r=0;r<num_ranks;r++){
+		ranks[r] = fork();
+		if (ranks[r]<0){ //The ranks already started would wait forever on this one's halos
+			printf("Starting rank %i failed: %s\n", r, strerror(errno));
+			for (int started=0;started<r;started++){
+				kill(ranks[started], SIGKILL);
+				waitpid(ranks[started], NULL, 0);
+			}
+			exit(-1);
+		}
+		if (ranks[r]==0){
+			int up = (rank_sockets && r>0)?sockets[r-1][1]:-1;
+			int down = (rank_sockets && r<num_ranks-1)?sockets[r][0]:-1;
+			runRank(r, shared, slots, up, down);
+			fflush(stdout);
+			_exit(0);
+		}
+	}
+	//Reaped in any order: the first rank to fail (an error exit or a signal) gets the others killed, since its
+	//neighbours would otherwise wait on its halos forever
+	bool failed=false;
+	for (int left=num_ranks;left>0;left--){
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid<0){
+			break;
+		}
+		for (int r=0;r<num_ranks;r++){
+			ranks[r] = ranks[r]==pid?0:ranks[r];
+		}
+		if (!failed && (!WIFEXITED(status) || WEXITSTATUS(status)!=0)){
+			failed=true;
+			for (int r=0;r<num_ranks;r++){
+				if (ranks[r]>0){
+					kill(ranks[r], SIGKILL);
+				}
+			}
+		}
+	}
+	if (failed){
+		printf("A rank failed.\n");
+		exit(-1);
+	}
+
+	printf("rank  rows     wall s  compute s  boundary s  halo wait s  halo MB  compute share\n");
+	double slowest=0; long population=0;
+	for (int r=0;r<num_ranks;r++){
+		rank_timing *t = &shared[r].timing;
+		printf("%4i %5i %10.3f %10.3f %11.3f %12.3f %8.2f %13.1f%%\n", r, t->rows, t->wall, t->compute, t->boundary_wait, t->halo_wait, t->halo_bytes/1e6, 100.0*t->compute/t->wall);
+		slowest = t->wall>slowest?t->wall:slowest;
+		population += t->population;
+	}
+	printf("Final population: %li\n", population);
+	printf("Throughput: %.3g cell updates/s\n", (double)board_option_width*board_option_height*run_generations/slowest);
+	munmap(segment, segment_size);
+}
+
+//Falls back to the buffer engine when the device has no image support or no 8-bit single channel images
+void imageInit(){
+	cl_bool images_supported = CL_FALSE;
+	clGetDeviceInfo(device_id, CL_DEVICE_IMAGE_SUPPORT, sizeof(images_supported), &images_supported, NULL);
+	cl_image_format format = {CL_R, CL_UNSIGNED_INT8};
+	cl_image_desc desc = {0};
+	desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+	desc.image_width = game_width; desc.image_height = game_height;
+	for (int i=0;i<2 && images_supported;i++){
+		state_images[i] = clCreateImage(context, CL_MEM_READ_WRITE, &format, &desc, NULL, &ret);
+		printf("State image creation: %i\n", ret);
+		if (ret!=CL_SUCCESS){
+			images_supported=CL_FALSE;
+		}
+	}
+	if (!images_supported){
+		printf("Image engine unavailable on this device, using the buffer engine\n");
+		image_engine=false;
+		return;
+	}
+	image_current=0; engine_stale=true;
+}
+
+void tiledInit(){
+	size_t max_group=0; //What step_tiled itself allows, which can be less than the device's limit
+	clGetKernelWorkGroupInfo(stepTiled, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_group), &max_group, NULL);
+	tile_rows=4; //A power of two, so it divides TILE_SIDE
+	while (tile_rows>0 && tile_rows*TILE_SIDE>max_group){
+		tile_rows/=2;
+	}
+	if (tile_rows==0){
+		printf("Tiled engine unavailable on this device, using the buffer engine\n");
+		tiled_engine=false;
+		return;
+	}
+	tile_bricks_x = (game_width+TILE_SIDE-1)/TILE_SIDE; tile_bricks_y = (game_height+TILE_SIDE-1)/TILE_SIDE;
+	tile_groups_x = (tile_bricks_x+TILE_GROUP-1)/TILE_GROUP; tile_groups_y = (tile_bricks_y+TILE_GROUP-1)/TILE_GROUP;
+	size_t cells = (size_t)tile_groups_x*tile_groups_y*TILE_GROUP*TILE_GROUP*TILE_SIDE*TILE_SIDE;
+	for (int i=0;i<2;i++){
+		state_tiles[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, cells, NULL, &ret);
+		printf("Tiled state buffer creation: %i\n", ret);
+	}
+	clSetKernelArg(tileState, 0, sizeof(game_state), &game_state);
+	clSetKernelArg(tileState, 2, sizeof(game_width), &game_width);
+	clSetKernelArg(tileState, 3, sizeof(game_height), &game_height);
+	clSetKernelArg(tileState, 4, sizeof(tile_groups_x), &tile_groups_x);
+	clSetKernelArg(untileState, 1, sizeof(game_state), &game_state);
+	clSetKernelArg(untileState, 2, sizeof(game_width), &game_width);
+	clSetKernelArg(untileState, 3, sizeof(game_height), &game_height);
+	clSetKernelArg(untileState, 4, sizeof(tile_groups_x), &tile_groups_x);
+	clSetKernelArg(stepTiled, 2, sizeof(tile_bricks_x), &tile_bricks_x);
+	clSetKernelArg(stepTiled, 3, sizeof(tile_bricks_y), &tile_bricks_y);
+	clSetKernelArg(stepTiled, 4, sizeof(tile_groups_x), &tile_groups_x);
+	clSetKernelArg(stepTiled, 5, (TILE_SIDE+2)*(TILE_SIDE+2), NULL);
+	tiles_current=0; engine_stale=true;
+}
+
+void setHeatmap(bool on){
+	heatmap = on && !image_engine && !tiled_engine && num_slabs==0;
+	if (on && !heatmap){
+		printf("The heatmap needs the buffer engine\n");
+	}
+	if (heatmap){
+		cl_uint zero=0;
+		ret = clEnqueueFillBuffer(command_queue, heat_counts, &zero, sizeof(zero), 0, sizeof(cl_uint)*heat_tiles_x*heat_tiles_y, 0, NULL, NULL);
+	}
+	//Off, the write kernels get no counts and skip the lookup
+	cl_mem counts = heatmap?heat_counts:NULL; int tiles_x = heatmap?heat_tiles_x:0; int tile = HEAT_TILE;
+	cl_kernel write = gl_sharing?writeStateToImage:writeStateToPixels;
+	ret = clSetKernelArg(write, 4, sizeof(cl_mem), heatmap?&counts:NULL);
+	ret = clSetKernelArg(write, 5, sizeof(tiles_x), &tiles_x);
+	ret = clSetKernelArg(write, 6, sizeof(tile), &tile);
+}
+
+void heatInit(){
+	heat_tiles_x = (game_width+HEAT_TILE-1)/HEAT_TILE; heat_tiles_y = (game_height+HEAT_TILE-1)/HEAT_TILE;
+	int tiles = heat_tiles_x*heat_tiles_y; int tile = HEAT_TILE;
+	heat_counts = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint)*tiles, NULL, &ret);
+	printf("Heatmap buffer creation: %i\n", ret);
+	clSetKernelArg(updateStateHeat, 0, sizeof(adjacencies), &adjacencies);
+	clSetKernelArg(updateStateHeat, 1, sizeof(game_state), &game_state);
+	clSetKernelArg(updateStateHeat, 2, sizeof(game_width), &game_width);
+	clSetKernelArg(updateStateHeat, 3, sizeof(game_height), &game_height);
+	clSetKernelArg(updateStateHeat, 4, sizeof(heat_counts), &heat_counts);
+	clSetKernelArg(updateStateHeat, 5, sizeof(heat_tiles_x), &heat_tiles_x);
+	clSetKernelArg(updateStateHeat, 6, sizeof(tile), &tile);
+	clSetKernelArg(decayHeat, 0, sizeof(heat_counts), &heat_counts);
+	clSetKernelArg(decayHeat, 1, sizeof(tiles), &tiles);
+	setHeatmap(heatmap);
+}
+
+//One line per row of tiles, each the tile's recent changes per generation
+void writeHeatmap(const char *path){
+	int tiles = heat_tiles_x*heat_tiles_y;
+	cl_uint *counts = malloc(sizeof(cl_uint)*tiles);
+	ret = clEnqueueReadBuffer(command_queue, heat_counts, CL_TRUE, 0, sizeof(cl_uint)*tiles, counts, 0, NULL, NULL);
+	FILE *fp = fopen(path, "w");
+	if (fp==NULL){
+		printf("Could not open heatmap file %s\n", path);
+		free(counts);
+		return;
+	}
+	fprintf(fp, "# tiles %ix%i, tile %i cells, generation %lu, changes per generation\n", heat_tiles_x, heat_tiles_y, HEAT_TILE, board_generation);
+	for (int y=0;y<heat_tiles_y;y++){
+		for (int x=0;x<heat_tiles_x;x++){
+			fprintf(fp, x==0?"%.2f":" %.2f", (double)counts[y*heat_tiles_x+x]/HEAT_PER_CHANGE);
+		}
+		fprintf(fp, "\n");
+	}
+	fclose(fp);
+	free(counts);
+	printf("Heatmap written to %s\n", path);
+}
+
+//Allocates the board buffers and sets every kernel argument that does not change per launch
+void boardInit(){
+	game_pixels = (size_t)game_width * game_height;
+	game_state = clCreateBuffer(context, CL_MEM_READ_WRITE, game_pixels, NULL, &ret);
+	printf("Game state buffer creation: %i\n", ret);
+	adjacencies = clCreateBuffer(context, CL_MEM_READ_WRITE, game_pixels, NULL, &ret);
+	printf("Adjacencies buffer creation: %i\n", ret);
+
+	int border_width = BORDER_WIDTH;
+	printf("\n");
+	//Set up arguments for initializeState kernel
+	ret = clSetKernelArg(initializeState, 0, sizeof(game_state), &game_state);// Maybe (void *)&game_state, and likewise for other memory objects
+	printf("Kernel setup 0 return: %i\n", ret);
+	ret = clSetKernelArg(initializeState, 1, sizeof(border_width), &border_width);
+	printf("Kernel setup 1 return: %i\n", ret);
+	ret = clSetKernelArg(initializeState, 2, sizeof(game_width), &game_width);
+	printf("Kernel setup 2 return: %i\n", ret);
+	ret = clSetKernelArg(initializeState, 3, sizeof(game_height), &game_height);
+	printf("Kernel setup 3 return: %i\n", ret);
+
+	//Set up arguments for writeStateToImage kernel
+	if (gl_sharing){
+		ret = clSetKernelArg(writeStateToImage, 0, sizeof(game_state), &game_state);
+		printf("Kernel setup 0 return: %i\n", ret);
+		ret = clSetKernelArg(writeStateToImage, 1, sizeof(CL_board_texture), &CL_board_texture);
+		printf("Kernel setup 1 return: %i\n", ret);
+		ret = clSetKernelArg(writeStateToImage, 2, sizeof(game_width), &game_width);
+		printf("Kernel setup 2 return: %i\n", ret);
+		ret = clSetKernelArg(writeStateToImage, 3, sizeof(game_height), &game_height);
+		printf("Kernel setup 3 return: %i\n", ret);
+	}
+	else{
+		ret = clSetKernelArg(writeStateToPixels, 0, sizeof(game_state), &game_state);
+		printf("Kernel setup 0 return: %i\n", ret);
+		ret = clSetKernelArg(writeStateToPixels, 2, sizeof(game_width), &game_width);
+		printf("Kernel setup 2 return: %i\n", ret);
+		ret = clSetKernelArg(writeStateToPixels, 3, sizeof(game_height), &game_height);
+		printf("Kernel setup 3 return: %i\n", ret);
+	}
+
+	//Set up arguments for computeAdjacencies kernel
+	ret = clSetKernelArg(calculateAdjacencies, 0, sizeof(game_state), &game_state);
+	printf("Kernel setup 0 return: %i\n", ret);
+	ret = clSetKernelArg(calculateAdjacencies, 1, sizeof(adjacencies), &adjacencies);
+	printf("Kernel setup 1 return: %i\n", ret);
+	ret = clSetKernelArg(calculateAdjacencies, 2, sizeof(border_width), &border_width);
+	printf("Kernel setup 2 return: %i\n", ret);
+	ret = clSetKernelArg(calculateAdjacencies, 3, sizeof(game_width), &game_width);
+	printf("Kernel setup 3 return: %i\n", ret);
+	ret = clSetKernelArg(calculateAdjacencies, 4, sizeof(game_height), &game_height);
+	printf("Kernel setup 4 return: %i\n", ret);
+
+	//Set up arguments for computeState kernel
+	ret = clSetKernelArg(updateState, 0, sizeof(adjacencies), &adjacencies);
+	printf("Kernel setup 0 return: %i\n", ret);
+	ret = clSetKernelArg(updateState, 1, sizeof(game_state), &game_state);
+	printf("Kernel setup 1 return: %i\n", ret);
+	ret = clSetKernelArg(updateState, 2, sizeof(game_width), &game_width);
+	printf("Kernel setup 2 return: %i\n", ret);
+	ret = clSetKernelArg(updateState, 3, sizeof(game_height), &game_height);
+	printf("Kernel setup 3 return: %i\n", ret);
+
+	//Set up arguments for flipSquare kernel
+	ret = clSetKernelArg(flipSquare, 0, sizeof(game_state), &game_state);
+	printf("Kernel setup 0 return: %i\n", ret);
+	ret = clSetKernelArg(flipSquare, 3, sizeof(game_width), &game_width);
+	printf("Kernel setup 3 return: %i\n", ret);
+
+	//Set up arguments for zeroAdjacencies kernel
+	ret = clSetKernelArg(zeroAdjacencies, 0, sizeof(adjacencies), &adjacencies);
+	printf("Kernel setup 0 return: %i\n", ret);
+	ret = clSetKernelArg(zeroAdjacencies, 1, sizeof(game_width), &game_width);
+	printf("Kernel setup 1 return: %i\n", ret);
+	ret = clSetKernelArg(zeroAdjacencies, 2, sizeof(game_height), &game_height);
+	printf("Kernel setup 2 return: %i\n", ret);
+
+	if (image_engine){
+		imageInit();
+	}
+	if (tiled_engine){
+		tiledInit();
+	}
+	heatInit();
+}
+
+cl_kernel launchKernel(int kind){
+	switch (kind){
+		case LAUNCH_ZERO_ADJACENCIES: return zeroAdjacencies;
+		case LAUNCH_COMPUTE_ADJACENCIES: return calculateAdjacencies;
+		case LAUNCH_COMPUTE_STATE: return heatmap?updateStateHeat:updateState;
+		case LAUNCH_WRITE_STATE: return gl_sharing?writeStateToImage:writeStateToPixels;
+		default: return initializeState;
+	}
+}
+
+size_t roundUp(size_t value, size_t multiple){
+	return multiple==0?value:(value+multiple-1)/multiple*multiple;
+}
+
+void setLaunchShape(launch_shape *shape, cl_uint dims, size_t local_x, size_t local_y){
+	shape->dims=dims;
+	shape->local[0]=local_x; shape->local[1]=dims==2?local_y:1;
+	if (dims==2){
+		shape->global[0]=roundUp(game_width, local_x); shape->global[1]=roundUp(game_height, local_x==0?0:local_y);
+	}
+	else{
+		shape->global[0]=roundUp(game_pixels, local_x); shape->global[1]=1;
+	}
+}
+
+cl_int enqueueBoardKernel(int kind, cl_event *event){
+	launch_shape *shape = &launch_shapes[kind];
+	if (kind==LAUNCH_INITIALIZE_STATE){ //Replaces the whole board, so whatever the engine had since is dropped
+		board_behind=false;
+	}
+	cl_int err = clEnqueueNDRangeKernel(command_queue, launchKernel(kind), shape->dims, NULL, shape->global, shape->local[0]==0?NULL:shape->local, 0, NULL, event);
+	if (err!=CL_SUCCESS && event!=NULL){ //A failed enqueue makes no event, so a profiling slot must not be read
+		*event=NULL;
+	}
+	return err;
+}
+
+void launchShapesPath(char *path, size_t length){
+	unsigned long long key = 0xcbf29ce484222325ULL;
+	key=hashDeviceString(key, device_id, CL_DEVICE_NAME);
+	key=hashDeviceString(key, device_id, CL_DRIVER_VERSION);
+	key=hashBytes(key, &game_width, sizeof(game_width));
+	key=hashBytes(key, &game_height, sizeof(game_height));
+	key=hashBytes(key, &gl_sharing, sizeof(gl_sharing));
+	key=hashBytes(key, program_options, strlen(program_options)+1);
+	size_t code_length; //A kernel edit can move the best shape, so the source is part of the key
+	char *code_str = readSourceFile("cl_kernel.cl", &code_length);
+	key=hashBytes(key, code_str, code_length);
+	free(code_str);
+	snprintf(path, length, "%s/launch_%016llx.txt", BINARY_CACHE_DIR, key);
+}
+
+bool loadLaunchShapes(const char *path){
+	FILE *fp = fopen(path, "r");
+	if (fp==NULL){
+		return false;
+	}
+	char name[64]; unsigned int dims; size_t local_x, local_y;
+	while (fscanf(fp, "%63s %u %zu %zu", name, &dims, &local_x, &local_y)==4){
+		for (int k=0;k<LAUNCH_KINDS;k++){
+			if (strcmp(name, launch_names[k])==0 && (dims==1 || dims==2)){
+				setLaunchShape(&launch_shapes[k], dims, local_x, local_y);
+			}
+		}
+	}
+	fclose(fp);
+	printf("Launch shapes loaded from %s\n", path);
+	return true;
+}
+
+void saveLaunchShapes(const char *path){
+	mkdir(BINARY_CACHE_DIR, 0755);
+	FILE *fp = fopen(path, "w");
+	if (fp==NULL){
+		return;
+	}
+	for (int k=0;k<LAUNCH_KINDS;k++){
+		fprintf(fp, "%s %u %zu %zu\n", launch_names[k], launch_shapes[k].dims, launch_shapes[k].local[0], launch_shapes[k].local[1]);
+	}
+	fclose(fp);
+}
+
+//Average seconds per launch of one kernel with the given shape, or -1 if the device refuses the shape
+double timeLaunchShape(int kind, launch_shape *shape){
+	const int warmup=2; const int runs=20;
+	launch_shape saved = launch_shapes[kind];
+	launch_shapes[kind] = *shape;
+	double elapsed=-1;
+	for (int i=0;i<warmup;i++){
+		if (enqueueBoardKernel(kind, NULL)!=CL_SUCCESS){
+			clFinish(command_queue);
+			launch_shapes[kind] = saved;
+			return -1;
+		}
+	}
+	clFinish(command_queue);
+	double start = monotonicSeconds();
+	for (int i=0;i<runs;i++){
+		enqueueBoardKernel(kind, NULL);
+	}
+	clFinish(command_queue);
+	elapsed = (monotonicSeconds()-start)/runs;
+	launch_shapes[kind] = saved;
+	return elapsed;
+}
+
+//Benchmarks driver-chosen, 1D and 2D shapes for every board kernel. Work-group sizes step through powers of two from the
+//kernel's preferred multiple up to CL_KERNEL_WORK_GROUP_SIZE. This clobbers the board, so callers initialize it afterwards.
+void autotuneLaunchShapes(){
+	int offset=1;
+	clSetKernelArg(calculateAdjacencies, 5, sizeof(offset), &offset);
+	if (gl_sharing){
+		clEnqueueAcquireGLObjects(command_queue, 1, &CL_board_texture, 0, NULL, NULL);
+	}
+	for (int k=0;k<LAUNCH_KINDS;k++){
+		size_t max_size=0; size_t multiple=1;
+		clGetKernelWorkGroupInfo(launchKernel(k), device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_size, NULL);
+		clGetKernelWorkGroupInfo(launchKernel(k), device_id, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &multiple, NULL);
+		multiple = multiple<8?8:multiple; //Keeps the candidate count down on CPUs, which report 1
+
+		launch_shape best = launch_shapes[k]; double best_time = timeLaunchShape(k, &best);
+		launch_shape candidate;
+		for (cl_uint dims=1;dims<=2;dims++){
+			setLaunchShape(&candidate, dims, 0, 0);
+			double time = timeLaunchShape(k, &candidate);
+			if (time>=0 && (best_time<0 || time<best_time)){
+				best=candidate; best_time=time;
+			}
+			for (size_t local_x=multiple;local_x<=max_size;local_x*=2){
+				for (size_t local_y=1;local_x*local_y<=max_size && local_y<=(dims==2?16:1);local_y*=2){
+					setLaunchShape(&candidate, dims, local_x, local_y);
+					time = timeLaunchShape(k, &candidate);
+					if (time>=0 && (best_time<0 || time<best_time)){
+						best=candidate; best_time=time;
+					}
+				}
+			}
+		}
+		launch_shapes[k]=best;
+		printf("Autotune %s: %uD, local %zux%zu, %.1f us\n", launch_names[k], best.dims, best.local[0], best.local[1], best_time*1e6);
+	}
+	if (gl_sharing){
+		clEnqueueReleaseGLObjects(command_queue, 1, &CL_board_texture, 0, NULL, NULL);
+	}
+	clFinish(command_queue);
+}
+
+//Default shapes, replaced by the stored winners for this device and board size (or a fresh --autotune run)
+void setupLaunchShapes(){
+	for (int k=0;k<LAUNCH_KINDS;k++){
+		size_t max_size=work_group_size;
+		clGetKernelWorkGroupInfo(launchKernel(k), device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_size, NULL);
+		setLaunchShape(&launch_shapes[k], 1, max_size<work_group_size?max_size:work_group_size, 1);
+	}
+	char path[256];
+	launchShapesPath(path, sizeof(path));
+	if (autotune){
+		autotuneLaunchShapes();
+		saveLaunchShapes(path);
+	}
+	else{
+		loadLaunchShapes(path);
+	}
+}
+
+//After a resize: the chosen shapes are kept and only their global sizes follow the new board, unless shapes are
+//stored for the new size. The tuner is not run again, since resizes can come every frame.
+void resizeLaunchShapes(){
+	for (int k=0;k<LAUNCH_KINDS;k++){
+		setLaunchShape(&launch_shapes[k], launch_shapes[k].dims, launch_shapes[k].local[0], launch_shapes[k].local[1]);
+	}
+	char path[256];
+	launchShapesPath(path, sizeof(path));
+	loadLaunchShapes(path);
+}
+
+//Without GL sharing: host-mapped CL buffers for the colored board, and a PBO to upload them to the texture
+void uploadInit(){
+	for (int i=0;i<UPLOAD_BUFFERS;i++){
+		upload_pixels[i] = clCreateBuffer(context, CL_MEM_WRITE_ONLY|CL_MEM_ALLOC_HOST_PTR, game_pixels*4, NULL, &ret);
+	}
+	printf("Upload buffer creation: %i\n", ret);
+	glGenBuffers(1, &upload_pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, game_pixels*4, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void uploadFree(){
+	for (int i=0;i<UPLOAD_BUFFERS;i++){
+		if (upload_mapped[i]!=NULL){
+			clWaitForEvents(1, &upload_mapped_event[i]);
+			clReleaseEvent(upload_mapped_event[i]);
+			clEnqueueUnmapMemObject(command_queue, upload_pixels[i], upload_mapped[i], 0, NULL, NULL);
+			upload_mapped[i]=NULL;
+		}
+		clReleaseMemObject(upload_pixels[i]);
+	}
+	glDeleteBuffers(1, &upload_pbo);
+}
+
+//Colors the current board into one mapped buffer while the one from the previous frame is copied into the texture,
+//so the copy overlaps the next generation. The displayed board is therefore one frame behind.
+void uploadBoard(){
+	int current = upload_current; int previous = (upload_current+1)%UPLOAD_BUFFERS;
+	ret = clSetKernelArg(writeStateToPixels, 1, sizeof(cl_mem), &upload_pixels[current]);
+	ret = enqueueBoardKernel(LAUNCH_WRITE_STATE, profileEvent(PROFILE_WRITE_STATE_TO_IMAGE));
+	upload_mapped[current] = clEnqueueMapBuffer(command_queue, upload_pixels[current], CL_FALSE, CL_MAP_READ, 0, game_pixels*4, 0, NULL, &upload_mapped_event[current], &ret);
+	clFlush(command_queue);
+
+	if (upload_mapped[previous]!=NULL){
+		clWaitForEvents(1, &upload_mapped_event[previous]);
+		clReleaseEvent(upload_mapped_event[previous]);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, game_pixels*4, NULL, GL_STREAM_DRAW); //Orphan, so this never waits for the last upload
+		void *staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, game_pixels*4, GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (staging!=NULL){
+			memcpy(staging, upload_mapped[previous], game_pixels*4);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindTexture(BOARD_TEXTURE_TYPE, board_texture);
+			glTexSubImage2D(BOARD_TEXTURE_TYPE, 0, 0, 0, game_width, game_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		clEnqueueUnmapMemObject(command_queue, upload_pixels[previous], upload_mapped[previous], 0, NULL, NULL);
+		upload_mapped[previous]=NULL;
+	}
+	upload_current=previous;
+}
+
+//One generation of the image engine
+void enqueueImageGeneration(){
+	size_t origin[3]={0,0,0}; size_t region[3]={game_width, game_height, 1};
+	if (engine_stale){
+		ret = clEnqueueCopyBufferToImage(command_queue, game_state, state_images[image_current], 0, origin, region, 0, NULL, profileEvent(PROFILE_BOARD_COPY));
+		engine_stale=false;
+	}
+	ret = clSetKernelArg(stepImage, 0, sizeof(cl_mem), &state_images[image_current]);
+	ret = clSetKernelArg(stepImage, 1, sizeof(cl_mem), &state_images[1-image_current]);
+	size_t global[2]={game_width, game_height};
+	ret = clEnqueueNDRangeKernel(command_queue, stepImage, 2, NULL, global, NULL, 0, NULL, profileEvent(PROFILE_STEP_IMAGE));
+	image_current=1-image_current;
+	board_behind=true;
+}
+
+//One generation of the tiled engine
+void enqueueTiledGeneration(){
+	if (engine_stale){
+		size_t padded[2]={(size_t)tile_groups_x*TILE_GROUP*TILE_SIDE, (size_t)tile_groups_y*TILE_GROUP*TILE_SIDE};
+		ret = clSetKernelArg(tileState, 1, sizeof(cl_mem), &state_tiles[tiles_current]);
+		ret = clEnqueueNDRangeKernel(command_queue, tileState, 2, NULL, padded, NULL, 0, NULL, profileEvent(PROFILE_BOARD_COPY));
+		engine_stale=false;
+	}
+	ret = clSetKernelArg(stepTiled, 0, sizeof(cl_mem), &state_tiles[tiles_current]);
+	ret = clSetKernelArg(stepTiled, 1, sizeof(cl_mem), &state_tiles[1-tiles_current]);
+	size_t global[2]={(size_t)tile_bricks_x*TILE_SIDE, (size_t)tile_bricks_y*tile_rows}; size_t local[2]={TILE_SIDE, tile_rows};
+	ret = clEnqueueNDRangeKernel(command_queue, stepTiled, 2, NULL, global, local, 0, NULL, profileEvent(PROFILE_STEP_TILED));
+	tiles_current=1-tiles_current;
+	board_behind=true;
+}
+
+//Fills the part of the given rectangle that lies on the board in one launch
+cl_int enqueueFillRandom(int x0, int y0, int width, int height, cl_uint stream){
+	int x1 = x0+width<game_width?x0+width:game_width; int y1 = y0+height<game_height?y0+height:game_height;
+	x0 = x0<0?0:x0; y0 = y0<0?0:y0;
+	if (x1<=x0 || y1<=y0){
+		return CL_SUCCESS;
+	}
+	cl_uint seed_lo = soup_seed; cl_uint seed_hi = soup_seed>>32;
+	cl_ulong threshold = densityThreshold(soup_density);
+	clSetKernelArg(fillRandom, 0, sizeof(cl_mem), &game_state);
+	clSetKernelArg(fillRandom, 1, sizeof(game_width), &game_width);
+	clSetKernelArg(fillRandom, 2, sizeof(x0), &x0);
+	clSetKernelArg(fillRandom, 3, sizeof(y0), &y0);
+	clSetKernelArg(fillRandom, 4, sizeof(seed_lo), &seed_lo);
+	clSetKernelArg(fillRandom, 5, sizeof(seed_hi), &seed_hi);
+	clSetKernelArg(fillRandom, 6, sizeof(stream), &stream);
+	clSetKernelArg(fillRandom, 7, sizeof(threshold), &threshold);
+	int first_row=0;
+	clSetKernelArg(fillRandom, 8, sizeof(first_row), &first_row);
+	size_t global[2] = {x1-x0, y1-y0};
+	syncBoard(); //Only part of the board is filled, the rest has to be current
+	engine_stale=true;
+	return clEnqueueNDRangeKernel(command_queue, fillRandom, 2, NULL, global, NULL, 0, NULL, NULL);
+}
+
+//Encodes words as runs: a count of zero words, a count of literal words, then the literals
+size_t encodeZeroRuns(const cl_uint *in, size_t count, cl_uint *out){
+	size_t length=0; size_t i=0;
+	while (i<count){
+		size_t zeros=i;
+		while (i<count && in[i]==0){
+			i++;
+		}
+		size_t literals=i;
+		while (i<count && (in[i]!=0 || (i+1<count && in[i+1]!=0))){ //Single zero words stay in the literal run
+			i++;
+		}
+		out[length++]=literals-zeros;
+		out[length++]=i-literals;
+		memcpy(out+length, in+literals, (i-literals)*sizeof(cl_uint));
+		length+=i-literals;
+	}
+	return length;
+}
+
+//XORs an encoded entry into target
+void applyZeroRuns(const cl_uint *in, size_t length, cl_uint *target){
+	size_t word=0;
+	for (size_t i=0;i<length;){
+		word+=in[i];
+		cl_uint literals=in[i+1];
+		i+=2;
+		for (cl_uint l=0;l<literals;l++){
+			target[word++]^=in[i++];
+		}
+	}
+}
+
+//Zero-run encodes a board given as its nonzero words, (index, word) pairs in index order
+size_t encodePairs(const cl_uint *pairs, size_t count, cl_uint *out){
+	size_t length=0; cl_uint next=0;
+	for (size_t i=0;i<count;){
+		cl_uint first=pairs[2*i]; cl_uint word=first;
+		out[length++]=first-next;
+		size_t literals=length++;
+		while (i<count && pairs[2*i]==word){
+			out[length++]=pairs[2*i+1];
+			word++; i++;
+		}
+		out[literals]=word-first;
+		next=word;
+	}
+	return length;
+}
+
+void *journalWriter(void *arg){
+	unsigned char *compressed=NULL; uLongf capacity=0;
+	while (true){
+		pthread_mutex_lock(&journal_mutex);
+		while (journal_head==NULL && !journal_stopping){
+			pthread_cond_wait(&journal_ready, &journal_mutex);
+		}
+		journal_job *job = journal_head;
+		if (job==NULL){
+			pthread_mutex_unlock(&journal_mutex);
+			break;
+		}
+		journal_head=job->next;
+		if (journal_head==NULL){
+			journal_tail=NULL;
+		}
+		journal_queued--;
+		pthread_cond_signal(&journal_space);
+		pthread_mutex_unlock(&journal_mutex);
+
+		uLongf length = compressBound(job->length*sizeof(cl_uint));
+		if (length>capacity){
+			capacity=length;
+			compressed=realloc(compressed, capacity);
+		}
+		compress2(compressed, &length, (const Bytef *)job->data, job->length*sizeof(cl_uint), 1);
+		journal_record record = {job->keyframe, job->length, length, job->span, job->generation};
+		long offset = ftell(journal_file);
+		fwrite(&record, sizeof(record), 1, journal_file);
+		fwrite(compressed, 1, length, journal_file);
+		if (job->keyframe){ //The keyframe reaches the file before the index points at it, so a crash cannot leave it dangling
+			fflush(journal_file);
+			journal_index_entry entry = {job->generation, offset};
+			fwrite(&entry, sizeof(entry), 1, journal_index);
+			fflush(journal_index);
+		}
+		free(job);
+	}
+	fflush(journal_file);
+	free(compressed);
+	return NULL;
+}
+
+void journalInit(){
+	journal_file = fopen(journal_path, "wb");
+	char index_path[512];
+	snprintf(index_path, sizeof(index_path), "%s.idx", journal_path);
+	journal_index = fopen(index_path, "wb");
+	if (journal_file==NULL || journal_index==NULL){
+		printf("Could not open journal %s\n", journal_path);
+		exit(-1);
+	}
+	journal_header header = {JOURNAL_MAGIC, 2, game_width, game_height};
+	fwrite(&header, sizeof(header), 1, journal_file);
+	pthread_create(&journal_thread, NULL, journalWriter, NULL);
+}
+
+//Queues one encoded record. Returns false if it was dropped, in which case the next record has to be a keyframe.
+bool journalSubmit(const cl_uint *encoded, size_t length, bool keyframe, unsigned long generation, unsigned long span){
+	pthread_mutex_lock(&journal_mutex);
+	if (journal_policy==JOURNAL_THROTTLE){
+		while (journal_queued>=JOURNAL_QUEUE){
+			pthread_cond_wait(&journal_space, &journal_mutex);
+		}
+	}
+	else if (journal_policy==JOURNAL_DROP && journal_queued>=JOURNAL_QUEUE){
+		journal_dropped++;
+		pthread_mutex_unlock(&journal_mutex);
+		return false;
+	}
+	pthread_mutex_unlock(&journal_mutex);
+
+	journal_job *job = malloc(sizeof(journal_job)+length*sizeof(cl_uint));
+	job->next=NULL; job->keyframe=keyframe; job->generation=generation; job->span=span; job->length=length;
+	memcpy(job->data, encoded, length*sizeof(cl_uint));
+	pthread_mutex_lock(&journal_mutex);
+	if (journal_tail!=NULL){
+		journal_tail->next=job;
+	}
+	else{
+		journal_head=job;
+	}
+	journal_tail=job;
+	journal_queued++;
+	journal_records++;
+	pthread_cond_signal(&journal_ready);
+	pthread_mutex_unlock(&journal_mutex);
+	return true;
+}
+
+void journalFinish(){
+	pthread_mutex_lock(&journal_mutex);
+	journal_stopping=true;
+	pthread_cond_signal(&journal_ready);
+	pthread_mutex_unlock(&journal_mutex);
+	pthread_join(journal_thread, NULL);
+	fclose(journal_file);
+	fclose(journal_index);
+	printf("Journal: %li records written to %s, %li dropped\n", journal_records, journal_path, journal_dropped);
+}
+
+void historyInit(){
+	history_enabled = history_budget>0 && num_slabs==0;
+	if (!history_enabled && journal_path==NULL){
+		return;
+	}
+	history_words=(game_pixels+31)/32;
+	history_previous = clCreateBuffer(context, CL_MEM_READ_WRITE, history_words*sizeof(cl_uint), NULL, &ret);
+	history_delta = clCreateBuffer(context, CL_MEM_WRITE_ONLY, history_words*sizeof(cl_uint), NULL, &ret);
+	printf("History buffer creation: %i\n", ret);
+	cl_uint zero=0;
+	clEnqueueFillBuffer(command_queue, history_previous, &zero, sizeof(zero), 0, history_words*sizeof(cl_uint), 0, NULL, NULL);
+	size_t blocks = (history_words+HISTORY_BLOCK-1)/HISTORY_BLOCK;
+	for (int k=0;k<2;k++){
+		history_offsets[k] = clCreateBuffer(context, CL_MEM_READ_WRITE, (blocks+1)*sizeof(cl_uint), NULL, &ret);
+		history_pairs[k] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, history_words*2*sizeof(cl_uint), NULL, &ret);
+		history_host_pairs[k] = malloc(history_words*2*sizeof(cl_uint));
+		history_guess[k] = HISTORY_READ_MIN<history_words?HISTORY_READ_MIN:history_words;
+	}
+	history_encoded = malloc((history_words+2)*sizeof(cl_uint)*2); //Worst case alternates zero and non-zero words
+	history_board = malloc(history_words*sizeof(cl_uint));
+	cl_uint cells=game_pixels;
+	clSetKernelArg(packDelta, 0, sizeof(cl_mem), &game_state);
+	clSetKernelArg(packDelta, 1, sizeof(cl_mem), &history_previous);
+	clSetKernelArg(packDelta, 2, sizeof(cl_mem), &history_delta);
+	clSetKernelArg(packDelta, 3, sizeof(cells), &cells);
+	clSetKernelArg(unpackState, 0, sizeof(cl_mem), &history_previous);
+	clSetKernelArg(unpackState, 1, sizeof(cl_mem), &game_state);
+	clSetKernelArg(unpackState, 2, sizeof(cells), &cells);
+	cl_uint count=history_words; cl_uint block=HISTORY_BLOCK; cl_uint num_blocks=blocks;
+	clSetKernelArg(countWords, 1, sizeof(count), &count);
+	clSetKernelArg(countWords, 2, sizeof(block), &block);
+	clSetKernelArg(scanCounts, 1, sizeof(num_blocks), &num_blocks);
+	clSetKernelArg(compactWords, 1, sizeof(count), &count);
+	clSetKernelArg(compactWords, 2, sizeof(block), &block);
+	if (journal_path!=NULL){
+		journalInit();
+	}
+}
+
+void dropHistory(int first, int count){
+	for (int i=first;i<first+count;i++){
+		history_bytes-=history[i].length*sizeof(cl_uint);
+		free(history[i].data);
+	}
+	memmove(history+first, history+first+count, (history_count-first-count)*sizeof(history_entry));
+	history_count-=count;
+}
+
+//Takes in the record historyRecord left in flight: reads the pairs that did not fit the first read, encodes them and
+//appends the record to the history and the journal. History entries past the cursor (undone frames) are discarded.
+void historyFlush(){
+	if (!history_pending){
+		return;
+	}
+	history_pending=false;
+	clWaitForEvents(1, &history_read);
+	clReleaseEvent(history_read);
+	for (int k=0;k<2;k++){
+		if (history_want[k] && history_totals[k]>history_guess[k]){
+			ret = clEnqueueReadBuffer(command_queue, history_pairs[k], CL_TRUE, history_guess[k]*2*sizeof(cl_uint), (history_totals[k]-history_guess[k])*2*sizeof(cl_uint), history_host_pairs[k]+history_guess[k]*2, 0, NULL, NULL);
+		}
+		if (history_want[k]){ //The next record of this kind is likely about as big
+			size_t guess = history_totals[k]+history_totals[k]/4;
+			history_guess[k] = guess<HISTORY_READ_MIN?HISTORY_READ_MIN:guess;
+			history_guess[k] = history_guess[k]>history_words?history_words:history_guess[k];
+		}
+	}
+	bool keyframe = history_pending_keyframe; bool journal_keyframe = history_pending_journal_keyframe;
+
+	if (journal_path!=NULL){
+		int k = journal_keyframe?HISTORY_FULL:HISTORY_DELTA;
+		size_t length = encodePairs(history_host_pairs[k], history_totals[k], history_encoded);
+		if (journalSubmit(history_encoded, length, journal_keyframe, history_pending_generation, history_pending_span)){
+			journal_need_keyframe=false;
+			journal_since_keyframe = journal_keyframe?1:journal_since_keyframe+1;
+		}
+		else{
+			journal_need_keyframe=true;
+		}
+	}
+	if (!history_enabled){
+		return;
+	}
+	dropHistory(history_cursor+1, history_count-history_cursor-1);
+	if (history_count==history_capacity){
+		history_capacity = history_capacity==0?256:history_capacity*2;
+		history = realloc(history, history_capacity*sizeof(history_entry));
+	}
+	history_entry *entry = &history[history_count++];
+	int k = keyframe?HISTORY_FULL:HISTORY_DELTA;
+	entry->keyframe = keyframe;
+	entry->generation = history_pending_generation;
+	entry->span = history_pending_span;
+	entry->length = encodePairs(history_host_pairs[k], history_totals[k], history_encoded);
+	entry->data = malloc(entry->length*sizeof(cl_uint));
+	memcpy(entry->data, history_encoded, entry->length*sizeof(cl_uint));
+	history_bytes+=entry->length*sizeof(cl_uint);
+	history_since_keyframe = keyframe?1:history_since_keyframe+1;
+	history_cursor=history_count-1;
+
+	while (history_bytes>history_budget){ //Drop the oldest keyframe and its deltas, as long as another keyframe remains
+		int next=1;
+		while (next<history_count && !history[next].keyframe){
+			next++;
+		}
+		if (next>=history_count){
+			break;
+		}
+		dropHistory(0, next);
+		history_cursor-=next;
+	}
+}
+
+//Appends the board as it is once the queue reaches this point to the history and the journal. The packed board is
+//compacted on the device and read back without waiting; historyFlush takes the record in.
+void historyRecord(){
+	if (history_words==0){
+		return;
+	}
+	historyFlush();
+	history_pending_keyframe = history_enabled && (history_count==0 || history_since_keyframe>=HISTORY_KEYFRAME_INTERVAL);
+	history_pending_journal_keyframe = journal_path!=NULL && (journal_need_keyframe || journal_since_keyframe>=JOURNAL_KEYFRAME_INTERVAL);
+	history_pending_generation = board_generation;
+	history_pending_span = board_generation-recorded_generation;
+	recorded_generation = board_generation;
+	history_want[HISTORY_DELTA] = (history_enabled && !history_pending_keyframe) || (journal_path!=NULL && !history_pending_journal_keyframe);
+	history_want[HISTORY_FULL] = history_pending_keyframe || history_pending_journal_keyframe;
+	syncBoard();
+	ret = clEnqueueNDRangeKernel(command_queue, packDelta, 1, NULL, &history_words, NULL, 0, NULL, NULL);
+	size_t blocks = (history_words+HISTORY_BLOCK-1)/HISTORY_BLOCK; size_t one=1;
+	for (int k=0;k<2;k++){
+		if (!history_want[k]){
+			continue;
+		}
+		cl_mem words = k==HISTORY_DELTA?history_delta:history_previous;
+		clSetKernelArg(countWords, 0, sizeof(cl_mem), &words);
+		clSetKernelArg(countWords, 3, sizeof(cl_mem), &history_offsets[k]);
+		clSetKernelArg(scanCounts, 0, sizeof(cl_mem), &history_offsets[k]);
+		clSetKernelArg(compactWords, 0, sizeof(cl_mem), &words);
+		clSetKernelArg(compactWords, 3, sizeof(cl_mem), &history_offsets[k]);
+		clSetKernelArg(compactWords, 4, sizeof(cl_mem), &history_pairs[k]);
+		ret = clEnqueueNDRangeKernel(command_queue, countWords, 1, NULL, &blocks, NULL, 0, NULL, NULL);
+		ret = clEnqueueNDRangeKernel(command_queue, scanCounts, 1, NULL, &one, NULL, 0, NULL, NULL);
+		ret = clEnqueueNDRangeKernel(command_queue, compactWords, 1, NULL, &blocks, NULL, 0, NULL, NULL);
+		ret = clEnqueueReadBuffer(command_queue, history_offsets[k], CL_FALSE, blocks*sizeof(cl_uint), sizeof(cl_uint), &history_totals[k], 0, NULL, NULL);
+		ret = clEnqueueReadBuffer(command_queue, history_pairs[k], CL_FALSE, 0, history_guess[k]*2*sizeof(cl_uint), history_host_pairs[k], 0, NULL, NULL);
+	}
+	ret = clEnqueueMarkerWithWaitList(command_queue, 0, NULL, &history_read);
+	clFlush(command_queue);
+	history_pending=true;
+}
+
+//Releases the history buffers and entries, for historyInit to start over at a new board size
+void historyFree(){
+	historyFlush();
+	dropHistory(0, history_count);
+	history_cursor=-1; history_since_keyframe=0;
+	clReleaseMemObject(history_previous); clReleaseMemObject(history_delta);
+	for (int k=0;k<2;k++){
+		clReleaseMemObject(history_offsets[k]); clReleaseMemObject(history_pairs[k]);
+		free(history_host_pairs[k]);
+	}
+	free(history_encoded); free(history_board);
+}
+
+//Puts entry target back on the board: decodes the nearest keyframe at or before it and applies the deltas up to it
+void historyRestore(int target){
+	historyFlush();
+	if (!history_enabled || target<0 || target>=history_count || target==history_cursor){
+		return;
+	}
+	int first=target;
+	while (!history[first].keyframe){
+		first--;
+	}
+	memset(history_board, 0, history_words*sizeof(cl_uint));
+	for (int i=first;i<=target;i++){
+		applyZeroRuns(history[i].data, history[i].length, history_board);
+	}
+	ret = clEnqueueWriteBuffer(command_queue, history_previous, CL_FALSE, 0, history_words*sizeof(cl_uint), history_board, 0, NULL, NULL);
+	ret = clEnqueueNDRangeKernel(command_queue, unpackState, 1, NULL, &game_pixels, NULL, 0, NULL, NULL);
+	clFinish(command_queue); //history_board is reused by the next restore
+	engine_stale=true; board_behind=false;
+	history_cursor=target;
+	history_since_keyframe=target-first+1; //The next record drops everything after target
+	board_generation=history[target].generation;
+	recorded_generation=board_generation;
+	if (journal_path!=NULL){ //The journal continues from the restored board
+		size_t length = encodeZeroRuns(history_board, history_words, history_encoded);
+		journal_need_keyframe = !journalSubmit(history_encoded, length, true, board_generation, 0);
+		journal_since_keyframe=1;
+	}
+}
+
+//Live resize ("b" for the window's size, or following the window with --resize-with-window): the board is reallocated at
+//the new size, starting dead inside a fresh border, and the interior the old and new boards share is copied across on the
+//device with clEnqueueCopyBufferRect, anchored at the top left. The texture is respecified at the new size and shared
+//again, so nothing passes through the host. The rewind history starts over. Not available with slabs, a journal or a
+//recording, whose sizes are fixed.
+bool resizeBoard(int new_width, int new_height){
+	if (num_slabs>0 || journal_path!=NULL || capture_path!=NULL){
+		printf("Board resize is unavailable with slabs, a journal or a recording\n");
+		return false;
+	}
+	if (new_width<=2*BORDER_WIDTH || new_height<=2*BORDER_WIDTH || (new_width==game_width && new_height==game_height)){
+		return false;
+	}
+	syncBoard(); //The copy below is taken from game_state
+	clFinish(command_queue);
+	cl_mem old_state = game_state; int old_width = game_width; int old_height = game_height;
+	clReleaseMemObject(adjacencies);
+	if (image_engine){
+		clReleaseMemObject(state_images[0]); clReleaseMemObject(state_images[1]);
+	}
+	if (tiled_engine){
+		clReleaseMemObject(state_tiles[0]); clReleaseMemObject(state_tiles[1]);
+	}
+	clReleaseMemObject(heat_counts);
+	if (gl_sharing){
+		clReleaseMemObject(CL_board_texture);
+	}
+	else{
+		uploadFree();
+	}
+
+	game_width = new_width; game_height = new_height;
+	glBindTexture(BOARD_TEXTURE_TYPE, board_texture);
+	glTexImage2D(BOARD_TEXTURE_TYPE, 0, GL_RGBA8, game_width, game_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glUniform1i(glGetUniformLocation(shaderProgram, "game_width"), game_width);
+	glUniform1i(glGetUniformLocation(shaderProgram, "game_height"), game_height);
+	glFinish();
+	if (gl_sharing){
+		CL_board_texture=clCreateFromGLTexture(context, CL_MEM_READ_WRITE, BOARD_TEXTURE_TYPE, 0, board_texture, &ret);
+		printf("Texture grab return: %i\n", ret);
+	}
+	else{
+		uploadInit();
+	}
+	boardInit();
+	resizeLaunchShapes();
+
+	ret = enqueueBoardKernel(LAUNCH_INITIALIZE_STATE, NULL);
+	int border = BORDER_WIDTH;
+	size_t origin[3]={border, border, 0};
+	size_t region[3]={(old_width<game_width?old_width:game_width)-2*border, (old_height<game_height?old_height:game_height)-2*border, 1};
+	ret = clEnqueueCopyBufferRect(command_queue, old_state, game_state, origin, origin, region, old_width, 0, game_width, 0, 0, NULL, NULL);
+	printf("Board resize %ix%i -> %ix%i: %i\n", old_width, old_height, game_width, game_height, ret);
+	clReleaseMemObject(old_state); //Freed once the copy is done
+	engine_stale=true;
+
+	if (history_enabled){
+		historyFree();
+		historyInit();
+	}
+	return true;
+}
+
+//Enqueues one generation of the linear engine. The queue is in order, so nothing has to wait in between.
+void enqueueGeneration(){
+	if (image_engine){
+		enqueueImageGeneration();
+		return;
+	}
+	if (tiled_engine){
+		enqueueTiledGeneration();
+		return;
+	}
+	ret = enqueueBoardKernel(LAUNCH_ZERO_ADJACENCIES, profileEvent(PROFILE_ZERO_ADJACENCIES));
+	int offset;
+	for (int i=-1;i<=1;i++){
+		for (int j=-1;j<=1;j++){
+			if (i!=0 || j!=0){
+				offset = i*game_width+j;
+				ret = clSetKernelArg(calculateAdjacencies, 5, sizeof(offset), &offset);
+				ret = enqueueBoardKernel(LAUNCH_COMPUTE_ADJACENCIES, profileEvent(PROFILE_COMPUTE_ADJACENCIES));
+			}
+		}
+	}
+	ret = enqueueBoardKernel(LAUNCH_COMPUTE_STATE, profileEvent(PROFILE_COMPUTE_STATE));
+	if (heatmap){
+		size_t tiles = heat_tiles_x*heat_tiles_y;
+		ret = clEnqueueNDRangeKernel(command_queue, decayHeat, 1, NULL, &tiles, NULL, 0, NULL, NULL);
+	}
+}
+
+typedef struct {
+	unsigned char *pixels; //RGBA, bottom row first as glReadPixels returns it
+	char path[512];
+} png_job;
+
+png_job png_jobs[PNG_QUEUE];
+int png_job_head; int png_job_count;
+bool png_stopping;
+pthread_t png_workers[MAX_PNG_THREADS];
+pthread_mutex_t png_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t png_job_ready = PTHREAD_COND_INITIALIZER;
+pthread_cond_t png_slot_free = PTHREAD_COND_INITIALIZER;
+
+void writePNG(const char *path, unsigned char *pixels, int width, int height){
+	FILE *fp = fopen(path, "wb");
+	if (fp==NULL){
+		printf("Could not open %s\n", path);
+		return;
+	}
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info = png_create_info_struct(png);
+	if (setjmp(png_jmpbuf(png))){
+		printf("PNG encoding of %s failed\n", path);
+		png_destroy_write_struct(&png, &info);
+		fclose(fp);
+		return;
+	}
+	png_bytep *rows = malloc(height*sizeof(png_bytep));
+	for (int y=0;y<height;y++){
+		rows[y]=pixels+(size_t)(height-1-y)*width*4;
+	}
+	png_init_io(png, fp);
+	png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_set_compression_level(png, 1); //The board compresses well even at the fastest level
+	png_set_rows(png, info, rows);
+	png_write_png(png, info, PNG_TRANSFORM_IDENTITY, NULL);
+	png_destroy_write_struct(&png, &info);
+	free(rows);
+	fclose(fp);
+}
+
+void *pngWorker(void *arg){
+	pthread_mutex_lock(&png_mutex);
+	while (true){
+		while (png_job_count==0 && !png_stopping){
+			pthread_cond_wait(&png_job_ready, &png_mutex);
+		}
+		if (png_job_count==0){
+			break;
+		}
+		png_job job = png_jobs[png_job_head];
+		png_job_head=(png_job_head+1)%PNG_QUEUE;
+		png_job_count--;
+		pthread_cond_signal(&png_slot_free);
+		pthread_mutex_unlock(&png_mutex);
+		writePNG(job.path, job.pixels, game_width, game_height);
+		free(job.pixels);
+		pthread_mutex_lock(&png_mutex);
+	}
+	pthread_mutex_unlock(&png_mutex);
+	return NULL;
+}
+
+//Hands pixels over to the encoder pool. Blocks only if every queue slot is taken, since batch output must be complete.
+void pngSubmit(unsigned char *pixels, const char *path){
+	pthread_mutex_lock(&png_mutex);
+	while (png_job_count==PNG_QUEUE){
+		pthread_cond_wait(&png_slot_free, &png_mutex);
+	}
+	png_job *job = &png_jobs[(png_job_head+png_job_count)%PNG_QUEUE];
+	job->pixels=pixels;
+	snprintf(job->path, sizeof(job->path), "%s", path);
+	png_job_count++;
+	pthread_cond_signal(&png_job_ready);
+	pthread_mutex_unlock(&png_mutex);
+}
+
+//Makes a GL context without a display: EGL surfaceless (Mesa, including llvmpipe) first, then a hidden GLFW window
+void headlessGLInit(){
+	bool have_context=false;
+	#ifdef __linux__
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	EGLDisplay display = getPlatformDisplay!=NULL?getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL):EGL_NO_DISPLAY;
+	EGLint major, minor;
+	if (display!=EGL_NO_DISPLAY && eglInitialize(display, &major, &minor) && eglBindAPI(EGL_OPENGL_API)){
+		EGLint config_attributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+		EGLConfig config; EGLint num_configs=0;
+		if (!eglChooseConfig(display, config_attributes, &config, 1, &num_configs) || num_configs==0){
+			config=EGL_NO_CONFIG_KHR;
+		}
+		EGLint context_attributes[] = {EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 1, EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+		EGLContext egl_context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+		if (egl_context!=EGL_NO_CONTEXT && eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context)){
+			have_context = gladLoadGLLoader((GLADloadproc)eglGetProcAddress);
+			printf("EGL %i.%i surfaceless context\n", major, minor);
+		}
+	}
+	#endif
+	if (!have_context){
+		if (glfwInit() != GLFW_TRUE){
+			printf("No EGL or GLFW context available for headless rendering.\n");
+			exit(-1);
+		}
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		window = glfwCreateWindow(64, 64, "Conway", NULL, NULL);
+		if (window==NULL){
+			printf("No EGL or GLFW context available for headless rendering.\n");
+			exit(-1);
+		}
+		glfwMakeContextCurrent(window);
+		if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+			printf("Failed to initialize OpenGL context\n");
+			exit(-1);
+		}
+		printf("Hidden window context\n");
+	}
+	printf("OpenGL device: %s\n", glGetString(GL_RENDERER));
+	glDisable(GL_DEPTH_TEST); glDisable(GL_MULTISAMPLE);
+
+	game_width = board_option_width; game_height = board_option_height;
+	glSetupBoard();
+}
+
+//Uploads one read-back board, draws it into the offscreen framebuffer and queues the result for encoding
+void renderHeadlessFrame(const unsigned char *board_pixels, long generation){
+	glBindTexture(BOARD_TEXTURE_TYPE, board_texture);
+	glTexSubImage2D(BOARD_TEXTURE_TYPE, 0, 0, 0, game_width, game_height, GL_RGBA, GL_UNSIGNED_BYTE, board_pixels);
+	glClearColor(0, 0, 0, 255);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	unsigned char *frame = malloc(game_pixels*4);
+	glReadPixels(0, 0, game_width, game_height, GL_RGBA, GL_UNSIGNED_BYTE, frame);
+	char path[512]; snprintf(path, sizeof(path), "%s/gen_%08li.png", output_dir, generation);
+	pngSubmit(frame, path);
+}
+
+void runHeadless(){
+	headlessGLInit();
+
+	selectDevice();
+	gl_sharing=false;
+	cl_context_properties properties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties)platform_id, 0};
+	context = clCreateContext(properties, 1, &device_id, NULL, NULL, &ret);
+	printf("Context return: %i\n", ret);
+	clInit();
+	boardInit();
+	cl_mem board_pixels = clCreateBuffer(context, CL_MEM_WRITE_ONLY, game_pixels*4, NULL, &ret);
+	clSetKernelArg(writeStateToPixels, 1, sizeof(cl_mem), &board_pixels);
+	setupLaunchShapes();
+
+	enqueueBoardKernel(LAUNCH_INITIALIZE_STATE, NULL);
+	enqueueFillRandom(0, 0, game_width, game_height, 0);
+
+	//Render target the size of the board, drawn at zoom 1 with the camera at the origin
+	GLuint target_texture; GLuint target_fbo;
+	glGenTextures(1, &target_texture);
+	glBindTexture(GL_TEXTURE_2D, target_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, game_width, game_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glGenFramebuffers(1, &target_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target_texture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE){
+		printf("Offscreen framebuffer incomplete.\n");
+		exit(-1);
+	}
+	glViewport(0, 0, game_width, game_height);
+	GLfloat camera_pos[2]={0.0,0.0};
+	glUniform1i(glGetUniformLocation(shaderProgram, "zoom"), 1);
+	glUniform2fv(glGetUniformLocation(shaderProgram, "cameraPos"), 1, camera_pos);
+	glUniform1i(glGetUniformLocation(shaderProgram, "game_width"), game_width);
+	glUniform1i(glGetUniformLocation(shaderProgram, "game_height"), game_height);
+
+	mkdir(output_dir, 0755);
+	if (png_threads<1 || png_threads>MAX_PNG_THREADS){
+		png_threads=4;
+	}
+	for (int i=0;i<png_threads;i++){
+		pthread_create(&png_workers[i], NULL, pngWorker, NULL);
+	}
+
+	//Two host buffers: one is being read back while the other is being drawn, and the generations keep being enqueued meanwhile
+	unsigned char *readback[2] = {malloc(game_pixels*4), malloc(game_pixels*4)};
+	cl_event readback_done=NULL; int readback_index=0; long readback_generation=0;
+	double start_time = monotonicSeconds();
+	for (long g=0;g<=run_generations;g++){
+		if (g%render_every==0 || g==run_generations){
+			if (readback_done!=NULL){
+				clWaitForEvents(1, &readback_done);
+				clReleaseEvent(readback_done);
+				renderHeadlessFrame(readback[readback_index], readback_generation);
+			}
+			readback_index=1-readback_index;
+			syncBoard();
+			enqueueBoardKernel(LAUNCH_WRITE_STATE, NULL);
+			clEnqueueReadBuffer(command_queue, board_pixels, CL_FALSE, 0, game_pixels*4, readback[readback_index], 0, NULL, &readback_done);
+			readback_generation=g;
+		}
+		if (g<run_generations){
+			enqueueGeneration();
+		}
+		clFlush(command_queue);
+	}
+	clWaitForEvents(1, &readback_done);
+	clReleaseEvent(readback_done);
+	renderHeadlessFrame(readback[readback_index], readback_generation);
+	clFinish(command_queue);
+
+	pthread_mutex_lock(&png_mutex);
+	png_stopping=true;
+	pthread_cond_broadcast(&png_job_ready);
+	pthread_mutex_unlock(&png_mutex);
+	for (int i=0;i<png_threads;i++){
+		pthread_join(png_workers[i], NULL);
+	}
+	double elapsed = monotonicSeconds()-start_time;
+	printf("%i generations of %ix%i in %.3f s (%.1f generations/s), images in %s\n", run_generations, game_width, game_height, elapsed, run_generations/elapsed, output_dir);
+	free(readback[0]); free(readback[1]);
+}
+
+//Reads one record and its data. False at the end of the file, or for a record that is truncated or does not fit.
+bool readJournalRecord(FILE *fp, journal_record *record, unsigned char *compressed, cl_uint *encoded, size_t words){
+	if (fread(record, sizeof(*record), 1, fp)!=1 || record->encoded_words>(words+2)*2 || record->compressed_bytes>compressBound((words+2)*sizeof(cl_uint)*2)){
+		return false;
+	}
+	uLongf length = record->encoded_words*sizeof(cl_uint);
+	return fread(compressed, 1, record->compressed_bytes, fp)==record->compressed_bytes &&
+	       uncompress((Bytef *)encoded, &length, compressed, record->compressed_bytes)==Z_OK;
+}
+
+//Reads a journal up to the last record at or before replay_seek, starting from the newest keyframe in the index at or
+//before it, and writes that board to output_dir as replay_<generation>.png. A rewind writes a keyframe with a smaller
+//generation, so the index is searched to its end, not up to the first later generation. If that keyframe cannot be
+//read, the one before it is tried. A truncated tail (from a crash) just ends the replay.
+void runReplay(){
+	FILE *fp = fopen(replay_path, "rb");
+	journal_header header;
+	if (fp==NULL || fread(&header, sizeof(header), 1, fp)!=1 || header.magic!=JOURNAL_MAGIC){
+		printf("%s is not a journal\n", replay_path);
+		exit(-1);
+	}
+	size_t cells = (size_t)header.width*header.height; size_t words = (cells+31)/32;
+	cl_uint *encoded = malloc((words+2)*sizeof(cl_uint)*2);
+	unsigned char *compressed = malloc(compressBound((words+2)*sizeof(cl_uint)*2));
+
+	long *keyframes=NULL; int num_keyframes=0;
+	char index_path[512];
+	snprintf(index_path, sizeof(index_path), "%s.idx", replay_path);
+	FILE *index = fopen(index_path, "rb");
+	journal_index_entry entry;
+	while (index!=NULL && fread(&entry, sizeof(entry), 1, index)==1){
+		if (replay_seek<0 || entry.generation<=(cl_ulong)replay_seek){
+			keyframes = realloc(keyframes, (num_keyframes+1)*sizeof(long));
+			keyframes[num_keyframes++]=entry.offset;
+		}
+	}
+	if (index!=NULL){
+		fclose(index);
+	}
+	long start = sizeof(header);
+	journal_record record;
+	for (int k=num_keyframes-1;k>=0;k--){
+		if (fseek(fp, keyframes[k], SEEK_SET)==0 && readJournalRecord(fp, &record, compressed, encoded, words) && record.keyframe){
+			start=keyframes[k];
+			break;
+		}
+		printf("Keyframe at offset %li cannot be read, trying the one before\n", keyframes[k]);
+	}
+	free(keyframes);
+	fseek(fp, start, SEEK_SET);
+
+	cl_uint *board = calloc(words, sizeof(cl_uint));
+	long records=0; cl_ulong generation=0; bool have_keyframe=false;
+	while (readJournalRecord(fp, &record, compressed, encoded, words)){
+		if (replay_seek>=0 && record.generation>(cl_ulong)replay_seek){
+			if (record.generation-record.span<(cl_ulong)replay_seek){ //One frame ran past the target without recording it
+				printf("Generation %li falls inside a record spanning generations %lu-%lu, which were run in one frame\n", replay_seek, (unsigned long)(record.generation-record.span+1), (unsigned long)record.generation);
+			}
+			break;
+		}
+		if (record.keyframe){
+			memset(board, 0, words*sizeof(cl_uint));
+			have_keyframe=true;
+		}
+		if (have_keyframe){ //Deltas before the first keyframe have nothing to apply to
+			applyZeroRuns(encoded, record.encoded_words, board);
+			generation=record.generation;
+			records++;
+		}
+	}
+	fclose(fp);
+
+	unsigned char *pixels = malloc(cells*4); long population=0;
+	for (size_t i=0;i<cells;i++){
+		int x = i%header.width; int y = i/header.width;
+		bool border = y<BORDER_WIDTH || y>=(int)header.height-BORDER_WIDTH || x<BORDER_WIDTH || x>=(int)header.width-BORDER_WIDTH;
+		bool alive = (board[i/32]>>(i%32))&1;
+		population+=alive;
+		pixels[i*4]=border?0:alive*255; pixels[i*4+1]=border?0:alive*255; pixels[i*4+2]=border||alive?255:0; pixels[i*4+3]=255;
+	}
+	char path[512];
+	mkdir(output_dir, 0755);
+	snprintf(path, sizeof(path), "%s/replay_%lu.png", output_dir, (unsigned long)generation);
+	writePNG(path, pixels, header.width, header.height);
+	printf("Replayed %li records from offset %li: generation %lu, population %li, written to %s\n", records, start, (unsigned long)generation, population, path);
+	free(board); free(encoded); free(compressed); free(pixels);
+}
+
+//One generation of a small host grid, with dead cells past its edges
+void stepGrid(const char *src, char *dst, int width, int height){
+	for (int y=0;y<height;y++){
+		for (int x=0;x<width;x++){
+			int n=0;
+			for (int dy=-1;dy<=1;dy++){
+				for (int dx=-1;dx<=1;dx++){
+					int nx=x+dx; int ny=y+dy;
+					n += (dx!=0 || dy!=0) && nx>=0 && nx<width && ny>=0 && ny<height ? src[ny*width+nx] : 0;
+				}
+			}
+			dst[y*width+x] = (n==3)|((n==2)&src[y*width+x]);
+		}
+	}
+}
+
+//The live cells of grid cropped to their bounding box, as "WxH_" and hex rows of four cells per digit. With all eight
+//rotations and reflections (symmetric), the smallest of the eight strings is returned, so equal objects get equal codes.
+void canonicalForm(const char *grid, int width, int height, bool symmetric, char *out){
+	int x0=width; int y0=height; int x1=-1; int y1=-1;
+	for (int y=0;y<height;y++){
+		for (int x=0;x<width;x++){
+			if (grid[y*width+x]){
+				x0=x<x0?x:x0; x1=x>x1?x:x1; y0=y<y0?y:y0; y1=y>y1?y:y1;
+			}
+		}
+	}
+	if (x1<0){
+		strcpy(out, "empty");
+		return;
+	}
+	int w=x1-x0+1; int h=y1-y0+1;
+	char candidate[CANONICAL_LENGTH];
+	for (int t=0;t<(symmetric?8:1);t++){
+		int tw = t&4?h:w; int th = t&4?w:h; //Bit 2 transposes, bits 0 and 1 mirror
+		int length = snprintf(candidate, sizeof(candidate), "%ix%i_", tw, th);
+		for (int v=0;v<th && length<CANONICAL_LENGTH-(tw/4+3);v++){
+			for (int u=0;u<tw;u+=4){
+				int nibble=0;
+				for (int b=0;b<4 && u+b<tw;b++){
+					int a = t&4?v:u+b; int c = t&4?u+b:v;
+					a = t&1?w-1-a:a; c = t&2?h-1-c:c;
+					nibble |= grid[(y0+c)*width+x0+a]<<b;
+				}
+				candidate[length++]="0123456789abcdef"[nibble];
+			}
+			candidate[length++]= v<th-1?'.':'\0';
+		}
+		candidate[length-1]='\0';
+		if (t==0 || strcmp(candidate, out)<0){
+			strcpy(out, candidate);
+		}
+	}
+}
+
+void censusAdd(const char *code){
+	if (census_used*2>=census_capacity){ //Rehash into a table twice the size
+		census_entry *old = census; size_t old_capacity = census_capacity;
+		census_capacity = census_capacity==0?1024:census_capacity*2;
+		census = calloc(census_capacity, sizeof(census_entry));
+		census_used=0;
+		for (size_t i=0;i<old_capacity;i++){
+			if (old[i].code!=NULL){
+				size_t slot = hashBytes(0xcbf29ce484222325ULL, old[i].code, strlen(old[i].code))%census_capacity;
+				while (census[slot].code!=NULL){
+					slot=(slot+1)%census_capacity;
+				}
+				census[slot]=old[i];
+				census_used++;
+			}
+		}
+		free(old);
+	}
+	size_t slot = hashBytes(0xcbf29ce484222325ULL, code, strlen(code))%census_capacity;
+	while (census[slot].code!=NULL && strcmp(census[slot].code, code)!=0){
+		slot=(slot+1)%census_capacity;
+	}
+	if (census[slot].code==NULL){
+		census[slot].code=strdup(code);
+		census_used++;
+	}
+	census[slot].count++;
+}
+
+//Splits a settled board into objects. Cells that come within two of each other in any phase of the board's period can
+//interact, so they are grouped together: the parts of a beacon or a toad that are apart in one phase stay one object.
+//Each group is run on its own for period generations and named "xs<population>_" (still life) or "xp<period>_"
+//(oscillator) only if it comes back to its own cells. Otherwise it is "zz_" (e.g. a pseudo object whose parts only
+//settle together). The name ends in the group's smallest canonical form over all phases.
+void censusBoard(const char *board, int period){
+	static int labels[SEARCH_BOARD*SEARCH_BOARD]; static int stack[SEARCH_BOARD*SEARCH_BOARD];
+	static char phases[2][SEARCH_BOARD*SEARCH_BOARD]; static char cover[SEARCH_BOARD*SEARCH_BOARD];
+	const int margin=SEARCH_MAX_PERIOD; const int grid_size=SEARCH_BOARD+2*margin;
+	static char grid[3][(SEARCH_BOARD+2*SEARCH_MAX_PERIOD)*(SEARCH_BOARD+2*SEARCH_MAX_PERIOD)]; //Two phases and the start
+	char code[CANONICAL_LENGTH+32]; char form[CANONICAL_LENGTH]; char best[CANONICAL_LENGTH];
+	//Every cell alive in some phase of the board's period
+	memcpy(phases[0], board, sizeof(cover)); memcpy(cover, board, sizeof(cover));
+	for (int g=1, p=0;g<period;g++, p=1-p){
+		stepGrid(phases[p], phases[1-p], SEARCH_BOARD, SEARCH_BOARD);
+		for (int i=0;i<SEARCH_BOARD*SEARCH_BOARD;i++){
+			cover[i]|=phases[1-p][i];
+		}
+	}
+	memset(labels, 0, sizeof(labels));
+	int objects=0;
+	for (int start=0;start<SEARCH_BOARD*SEARCH_BOARD;start++){
+		if (!cover[start] || labels[start]){
+			continue;
+		}
+		objects++;
+		memset(grid[0], 0, sizeof(grid[0]));
+		int population=0; int top=0;
+		stack[top++]=start; labels[start]=objects;
+		while (top>0){
+			int cell=stack[--top]; int x=cell%SEARCH_BOARD; int y=cell/SEARCH_BOARD;
+			if (board[cell]){
+				grid[0][(y+margin)*grid_size+x+margin]=1;
+				population++;
+			}
+			for (int dy=-2;dy<=2;dy++){
+				for (int dx=-2;dx<=2;dx++){
+					int nx=x+dx; int ny=y+dy; int neighbour=ny*SEARCH_BOARD+nx;
+					if (nx>=0 && nx<SEARCH_BOARD && ny>=0 && ny<SEARCH_BOARD && cover[neighbour] && !labels[neighbour]){
+						labels[neighbour]=objects;
+						stack[top++]=neighbour;
+					}
+				}
+			}
+		}
+		if (population==0){
+			continue;
+		}
+		memcpy(grid[2], grid[0], sizeof(grid[2]));
+		int own_period=0; int phase=0;
+		canonicalForm(grid[0], grid_size, grid_size, true, best);
+		for (int g=1;g<=period;g++){
+			stepGrid(grid[phase], grid[1-phase], grid_size, grid_size);
+			phase=1-phase;
+			if (memcmp(grid[phase], grid[2], sizeof(grid[2]))==0){ //Its own cells again, in place
+				own_period=g;
+				break;
+			}
+			canonicalForm(grid[phase], grid_size, grid_size, true, form);
+			if (strcmp(form, best)<0){
+				strcpy(best, form);
+			}
+		}
+		if (own_period==1){
+			snprintf(code, sizeof(code), "xs%i_%s", population, best);
+		}
+		else if (own_period>1){
+			snprintf(code, sizeof(code), "xp%i_%s", own_period, best);
+		}
+		else{
+			snprintf(code, sizeof(code), "zz_%s", best);
+		}
+		censusAdd(code);
+	}
+}
 
+int compareCensus(const void *a, const void *b){
+	const census_entry *x=a; const census_entry *y=b;
+	return x->count!=y->count ? (x->count<y->count)-(x->count>y->count) : strcmp(x->code, y->code);
+}
 
-	calculateAdjacencies = clCreateKernel(program, "compute_adjacencies", &ret);
-	zeroAdjacencies = clCreateKernel(program, "zero_adjacencies", &ret);
-	updateState = clCreateKernel(program, "compute_state", &ret);
-	writeStateToImage = clCreateKernel(program, "write_state_to_image", &ret);
-	//printf("Write state kernel return: %i\n",ret);
-	initializeState = clCreateKernel(program, "initialize_state", &ret);
-	//printf ("Initialize state kernel return %i\n", ret);
-	flipSquare = clCreateKernel(program, "flip_square", &ret);
+void writeCensus(long soups, long unstable){
+	FILE *fp = fopen(census_path, "w");
+	if (fp==NULL){
+		printf("Could not open %s\n", census_path);
+		return;
+	}
+	size_t count=0;
+	for (size_t i=0;i<census_capacity;i++){
+		if (census[i].code!=NULL){
+			census[count++]=census[i];
+		}
+	}
+	qsort(census, count, sizeof(census_entry), compareCensus);
+	fprintf(fp, "# %li soups of %ix%i, seed %llu, density %.3f, %li not settled after %i generations\n", soups, SEARCH_SOUP, SEARCH_SOUP, (unsigned long long)soup_seed, soup_density, unstable, SEARCH_MAX_GENERATIONS);
+	for (size_t i=0;i<count;i++){
+		fprintf(fp, "%s %li\n", census[i].code, census[i].count);
+	}
+	fclose(fp);
+}
 
-	CL_board_texture=clCreateFromGLTexture(context, CL_MEM_READ_WRITE, BOARD_TEXTURE_TYPE, 0, board_texture, &ret);  //Should be able to change this to WRITE_ONLY later -- just READ_WRITE for debug
-	printf("Texture grab return: %i\n", ret);
-}	
+//Smallest period of a board over its window of hashes, or 0 if it has not settled
+int boardPeriod(const cl_uint *hashes){
+	for (int p=1;p<=SEARCH_MAX_PERIOD;p++){
+		bool repeats=true;
+		for (int i=p;i<SEARCH_WINDOW && repeats;i++){
+			repeats = hashes[i]==hashes[i-p];
+		}
+		if (repeats){
+			return p;
+		}
+	}
+	return 0;
+}
+
+//Context, queue and program for the modes that only compute
+void computeInit(){
+	selectDevice();
+	gl_sharing=false;
+	cl_context_properties properties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties)platform_id, 0};
+	context = clCreateContext(properties, 1, &device_id, NULL, NULL, &ret);
+	printf("Context return: %i\n", ret);
+	command_queue = clCreateCommandQueueWithProperties(context, device_id, NULL, &ret);
+	program = buildProgram(context, device_id, program_options);
+}
+
+//Sets the fixed step_batch arguments. The work-group is the largest square power of two up to 16x16 the kernel allows.
+//stats may be NULL when nothing reads the sums.
+void setupBatchStep(cl_kernel step, int width, int height, cl_mem rules, cl_mem stats, size_t boards, size_t local[3], size_t global[3]){
+	size_t max_size=256;
+	clGetKernelWorkGroupInfo(step, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_size), &max_size, NULL);
+	size_t side=16;
+	while (side>1 && side*side>max_size){
+		side/=2;
+	}
+	local[0]=side; local[1]=side; local[2]=1;
+	global[0]=roundUp(width, side); global[1]=roundUp(height, side); global[2]=boards;
+	int column=0;
+	clSetKernelArg(step, 2, sizeof(width), &width);
+	clSetKernelArg(step, 3, sizeof(height), &height);
+	clSetKernelArg(step, 4, sizeof(cl_mem), &rules);
+	clSetKernelArg(step, 5, sizeof(cl_mem), stats!=NULL?&stats:NULL);
+	clSetKernelArg(step, 6, sizeof(column), &column);
+	clSetKernelArg(step, 7, 3*side*side*sizeof(cl_uint), NULL);
+}
+
+void runSearch(){
+	computeInit();
+	cl_kernel step = clCreateKernel(program, "step_batch", &ret);
+	cl_kernel seed = clCreateKernel(program, "seed_soups", &ret);
+	cl_kernel hash = clCreateKernel(program, "hash_boards", &ret);
+
+	int batch = search_soups<search_batch?search_soups:search_batch;
+	size_t cells = SEARCH_BOARD*SEARCH_BOARD;
+	cl_mem boards[2];
+	for (int i=0;i<2;i++){
+		boards[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, batch*cells, NULL, &ret);
+	}
+	cl_mem hashes = clCreateBuffer(context, CL_MEM_WRITE_ONLY, batch*SEARCH_WINDOW*sizeof(cl_uint), NULL, &ret);
+	cl_mem slot_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY, batch*sizeof(cl_uint), NULL, &ret);
+	cl_mem soup_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY, batch*sizeof(cl_uint), NULL, &ret);
+	printf("Search buffer creation: %i (%i boards of %ix%i)\n", ret, batch, SEARCH_BOARD, SEARCH_BOARD);
+
+	int size=SEARCH_BOARD; int soup_size=SEARCH_SOUP; int window=SEARCH_WINDOW;
+	cl_uint seed_lo = soup_seed; cl_uint seed_hi = soup_seed>>32;
+	cl_ulong threshold = densityThreshold(soup_density);
+	cl_uint *rules = malloc(batch*sizeof(cl_uint));
+	for (int i=0;i<batch;i++){
+		rules[i]=LIFE_RULE;
+	}
+	cl_mem rule_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, batch*sizeof(cl_uint), rules, &ret);
+	free(rules);
+	size_t step_local[3]; size_t step_global[3];
+	setupBatchStep(step, size, size, rule_buffer, NULL, batch, step_local, step_global);
+	clSetKernelArg(seed, 1, sizeof(cl_mem), &slot_buffer);
+	clSetKernelArg(seed, 2, sizeof(cl_mem), &soup_buffer);
+	clSetKernelArg(seed, 3, sizeof(size), &size);
+	clSetKernelArg(seed, 4, sizeof(size), &size);
+	clSetKernelArg(seed, 5, sizeof(soup_size), &soup_size);
+	clSetKernelArg(seed, 6, sizeof(soup_size), &soup_size);
+	clSetKernelArg(seed, 7, sizeof(seed_lo), &seed_lo);
+	clSetKernelArg(seed, 8, sizeof(seed_hi), &seed_hi);
+	clSetKernelArg(seed, 9, sizeof(threshold), &threshold);
+	clSetKernelArg(hash, 1, sizeof(cl_mem), &hashes);
+	clSetKernelArg(hash, 2, sizeof(size), &size);
+	clSetKernelArg(hash, 3, sizeof(window), &window);
+
+	cl_uint *slot_list = malloc(batch*sizeof(cl_uint)); cl_uint *soup_list = malloc(batch*sizeof(cl_uint));
+	bool *active = malloc(batch*sizeof(bool)); int *age = calloc(batch, sizeof(int)); int *period = malloc(batch*sizeof(int));
+	cl_uint *host_hashes = malloc(batch*SEARCH_WINDOW*sizeof(cl_uint));
+	char *host_boards = malloc(batch*cells);
+	long next_soup=0; long finished=0; long unstable=0; int current=0;
+	int reseed=batch;
+	for (int i=0;i<batch;i++){
+		slot_list[i]=i; soup_list[i]=next_soup++; active[i]=true;
+	}
+	double start = monotonicSeconds(); double report = start;
+	while (finished<search_soups){
+		if (reseed>0){
+			clEnqueueWriteBuffer(command_queue, slot_buffer, CL_FALSE, 0, reseed*sizeof(cl_uint), slot_list, 0, NULL, NULL);
+			clEnqueueWriteBuffer(command_queue, soup_buffer, CL_FALSE, 0, reseed*sizeof(cl_uint), soup_list, 0, NULL, NULL);
+			clSetKernelArg(seed, 0, sizeof(cl_mem), &boards[current]);
+			size_t seed_global[3] = {SEARCH_BOARD, SEARCH_BOARD, reseed};
+			clEnqueueNDRangeKernel(command_queue, seed, 3, NULL, seed_global, NULL, 0, NULL, NULL);
+			clFinish(command_queue); //slot_list and soup_list are rewritten below
+		}
+		size_t hash_global = batch;
+		for (int g=0;g<SEARCH_CHUNK+SEARCH_WINDOW;g++){
+			clSetKernelArg(step, 0, sizeof(cl_mem), &boards[current]);
+			clSetKernelArg(step, 1, sizeof(cl_mem), &boards[1-current]);
+			ret = clEnqueueNDRangeKernel(command_queue, step, 3, NULL, step_global, step_local, 0, NULL, NULL);
+			current=1-current;
+			if (g>=SEARCH_CHUNK){
+				int column = g-SEARCH_CHUNK;
+				clSetKernelArg(hash, 0, sizeof(cl_mem), &boards[current]);
+				clSetKernelArg(hash, 4, sizeof(column), &column);
+				clEnqueueNDRangeKernel(command_queue, hash, 1, NULL, &hash_global, NULL, 0, NULL, NULL);
+			}
+		}
+		clEnqueueReadBuffer(command_queue, hashes, CL_TRUE, 0, batch*SEARCH_WINDOW*sizeof(cl_uint), host_hashes, 0, NULL, NULL);
+
+		bool settled=false;
+		for (int i=0;i<batch;i++){
+			period[i]=-1;
+			if (active[i]){
+				age[i]+=SEARCH_CHUNK+SEARCH_WINDOW;
+				period[i]=boardPeriod(host_hashes+i*SEARCH_WINDOW);
+				if (period[i]==0 && age[i]<SEARCH_MAX_GENERATIONS){
+					period[i]=-1;
+				}
+				settled|=period[i]>=0;
+			}
+		}
+		if (!settled){
+			reseed=0;
+			continue;
+		}
+		clEnqueueReadBuffer(command_queue, boards[current], CL_TRUE, 0, batch*cells, host_boards, 0, NULL, NULL);
+		reseed=0;
+		for (int i=0;i<batch;i++){
+			if (period[i]<0){
+				continue;
+			}
+			if (period[i]>0){
+				censusBoard(host_boards+i*cells, period[i]);
+			}
+			else{
+				unstable++;
+			}
+			finished++;
+			active[i]=false;
+			if (next_soup<search_soups){
+				slot_list[reseed]=i; soup_list[reseed]=next_soup++; reseed++;
+				active[i]=true; age[i]=0;
+			}
+		}
+		double now = monotonicSeconds();
+		if (now-report>=1.0){
+			printf("%li/%li soups, %.0f soups/s\n", finished, search_soups, finished/(now-start));
+			report=now;
+		}
+	}
+	double elapsed = monotonicSeconds()-start;
+	writeCensus(finished, unstable);
+	printf("%li soups in %.3f s (%.0f soups/s), %li not settled, %zu distinct objects in %s\n", finished, elapsed, finished/elapsed, unstable, census_used, census_path);
+}
+
+void runEnsemble(){
+	if (num_rules==0){
+		num_rules=1;
+		ensemble_rules[0]=LIFE_RULE; ensemble_rule_names[0]="B3/S23";
+	}
+	computeInit();
+	cl_kernel step = clCreateKernel(program, "step_batch", &ret);
+	cl_kernel seed = clCreateKernel(program, "seed_soups", &ret);
+	int width = board_option_set?board_option_width:512; int height = board_option_set?board_option_height:512;
+	size_t boards = (size_t)num_rules*ensemble_seeds; size_t cells = (size_t)width*height;
+
+	cl_mem state[2];
+	for (int i=0;i<2;i++){
+		state[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, boards*cells, NULL, &ret);
+	}
+	printf("Ensemble buffer creation: %i (%zu boards of %ix%i)\n", ret, boards, width, height);
+	cl_uint *rules = malloc(boards*sizeof(cl_uint)); cl_uint *slots = malloc(boards*sizeof(cl_uint)); cl_uint *soups = malloc(boards*sizeof(cl_uint));
+	for (size_t b=0;b<boards;b++){ //Board b runs rule b/seeds from soup stream b%seeds
+		rules[b]=ensemble_rules[b/ensemble_seeds]; slots[b]=b; soups[b]=b%ensemble_seeds;
+	}
+	cl_mem rule_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, boards*sizeof(cl_uint), rules, &ret);
+	cl_mem slot_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, boards*sizeof(cl_uint), slots, &ret);
+	cl_mem soup_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, boards*sizeof(cl_uint), soups, &ret);
+	size_t stats_size = boards*3*ENSEMBLE_STATS_CHUNK*sizeof(cl_uint);
+	cl_mem stats = clCreateBuffer(context, CL_MEM_READ_WRITE, stats_size, NULL, &ret);
+	cl_uint *host_stats = malloc(stats_size);
+
+	cl_uint seed_lo = soup_seed; cl_uint seed_hi = soup_seed>>32;
+	cl_ulong threshold = densityThreshold(soup_density);
+	clSetKernelArg(seed, 0, sizeof(cl_mem), &state[0]);
+	clSetKernelArg(seed, 1, sizeof(cl_mem), &slot_buffer);
+	clSetKernelArg(seed, 2, sizeof(cl_mem), &soup_buffer);
+	clSetKernelArg(seed, 3, sizeof(width), &width);
+	clSetKernelArg(seed, 4, sizeof(height), &height);
+	clSetKernelArg(seed, 5, sizeof(width), &width);
+	clSetKernelArg(seed, 6, sizeof(height), &height);
+	clSetKernelArg(seed, 7, sizeof(seed_lo), &seed_lo);
+	clSetKernelArg(seed, 8, sizeof(seed_hi), &seed_hi);
+	clSetKernelArg(seed, 9, sizeof(threshold), &threshold);
+	size_t seed_global[3] = {width, height, boards};
+	ret = clEnqueueNDRangeKernel(command_queue, seed, 3, NULL, seed_global, NULL, 0, NULL, NULL);
+	printf("Seed return: %i\n", ret);
+	size_t step_local[3]; size_t step_global[3];
+	setupBatchStep(step, width, height, rule_buffer, stats, boards, step_local, step_global);
+
+	FILE *csv = fopen(ensemble_csv_path, "w");
+	if (csv==NULL){
+		printf("Could not open %s\n", ensemble_csv_path);
+		exit(-1);
+	}
+	fprintf(csv, "generation,board,rule,seed,population,births,deaths\n");
+	cl_uint zero=0; int current=0;
+	double start = monotonicSeconds();
+	for (int g=0;g<run_generations;g+=ENSEMBLE_STATS_CHUNK){
+		int chunk = run_generations-g<ENSEMBLE_STATS_CHUNK?run_generations-g:ENSEMBLE_STATS_CHUNK;
+		clEnqueueFillBuffer(command_queue, stats, &zero, sizeof(zero), 0, stats_size, 0, NULL, NULL);
+		for (int column=0;column<chunk;column++){
+			clSetKernelArg(step, 0, sizeof(cl_mem), &state[current]);
+			clSetKernelArg(step, 1, sizeof(cl_mem), &state[1-current]);
+			clSetKernelArg(step, 6, sizeof(column), &column);
+			ret = clEnqueueNDRangeKernel(command_queue, step, 3, NULL, step_global, step_local, 0, NULL, NULL);
+			current=1-current;
+		}
+		clEnqueueReadBuffer(command_queue, stats, CL_TRUE, 0, boards*3*chunk*sizeof(cl_uint), host_stats, 0, NULL, NULL);
+		for (int column=0;column<chunk;column++){
+			for (size_t b=0;b<boards;b++){
+				cl_uint *row = host_stats+(column*boards+b)*3;
+				fprintf(csv, "%i,%zu,%s,%zu,%u,%u,%u\n", g+column+1, b, ensemble_rule_names[b/ensemble_seeds], b%ensemble_seeds, row[0], row[1], row[2]);
+			}
+		}
+	}
+	double elapsed = monotonicSeconds()-start;
+	fclose(csv);
+	int last = (run_generations-1)%ENSEMBLE_STATS_CHUNK;
+	for (size_t b=0;b<boards && run_generations>0;b++){
+		printf("Board %zu (%s, seed %zu): population %u\n", b, ensemble_rule_names[b/ensemble_seeds], b%ensemble_seeds, host_stats[(last*boards+b)*3]);
+	}
+	printf("%zu boards of %ix%i for %i generations in %.3f s (%.2f Gcell-generations/s), statistics in %s\n", boards, width, height, run_generations, elapsed,
+		boards*cells*(double)run_generations/elapsed*1e-9, ensemble_csv_path);
+	free(rules); free(slots); free(soups); free(host_stats);
+}
+
+//Known patterns for --verify, rows separated by '/', placed with their top left at (x, y) inside the border. A negative
+//coordinate counts from the middle of the board.
+typedef struct {
+	const char *name;
+	int x; int y;
+	const char *cells;
+} verify_pattern;
+
+verify_pattern verify_patterns[] = {
+	{"Gosper glider gun", 4, 4, "........................O/......................O.O/............OO......OO............OO/...........O...O....OO............OO/"
+		"OO........O.....O...OO/OO........O...O.OO....O.O/..........O.....O.......O/...........O...O/............OO"}, //Its gliders run into the far border
+	{"lightweight spaceships", 2, -1, ".O..O/O/O...O/OOOO/////.O..O/O/O...O/OOOO"},
+	{"R-pentomino", -1, -1, ".OO/OO/.O"},
+	{"acorn", -1, -1, ".O/...O/OO..OOO"},
+	{"diehard", -1, -1, "......O/OO/.O...OOO"},
+};
+
+void placePattern(char *board, const verify_pattern *pattern){
+	int x0 = pattern->x<0?game_width/2:BORDER_WIDTH+pattern->x; int y0 = pattern->y<0?game_height/2:BORDER_WIDTH+pattern->y;
+	int x=x0; int y=y0;
+	for (const char *c=pattern->cells;*c;c++){
+		if (*c=='/'){
+			x=x0; y++;
+		}
+		else{
+			board[(size_t)y*game_width+x]=*c=='O';
+			x++;
+		}
+	}
+}
+
+//Copies the board's interior (inside the border) to or from a dense grid
+void copyInterior(char *board, char *interior, bool to_board){
+	int width = game_width-2*BORDER_WIDTH; int height = game_height-2*BORDER_WIDTH;
+	for (int y=0;y<height;y++){
+		char *row = board+(size_t)(y+BORDER_WIDTH)*game_width+BORDER_WIDTH;
+		if (to_board){
+			memcpy(row, interior+(size_t)y*width, width);
+		}
+		else{
+			memcpy(interior+(size_t)y*width, row, width);
+		}
+	}
+}
+
+//Runs one engine from start for run_generations into out. Returns false if the engine is unavailable here.
+bool runVerifyEngine(int engine, const char *start, char *out, bool image_available, bool tiled_available, int *slabs_requested){
+	static bool slabs_ready=false; static cl_kernel batch_step=NULL;
+	int width = game_width-2*BORDER_WIDTH; int height = game_height-2*BORDER_WIDTH; size_t cells = (size_t)width*height;
+	if (engine==VERIFY_SLABS){
+		if (*slabs_requested==0){
+			return false;
+		}
+		num_slabs=*slabs_requested;
+		if (!slabs_ready){
+			slabInit();
+			*slabs_requested=num_slabs;
+			slabs_ready=true;
+		}
+		slabClear();
+		for (int i=0;i<num_slabs;i++){ //Owned rows plus whichever halo rows lie on the board
+			slab *sl = &slabs[i];
+			int first = sl->first_row>0?sl->first_row-1:0; int last = sl->first_row+sl->rows<game_height?sl->first_row+sl->rows:game_height-1;
+			size_t offset = (size_t)(first-sl->first_row+1)*game_width;
+			clEnqueueWriteBuffer(sl->compute_queue, sl->state[slab_current], CL_TRUE, offset, (size_t)(last-first+1)*game_width, start+(size_t)first*game_width, 0, NULL, NULL);
+		}
+		for (int g=0;g<run_generations;g++){
+			slabStep();
+		}
+		slabGather();
+		clFinish(command_queue);
+		memcpy(out, slab_host_board, game_pixels);
+		num_slabs=0;
+		return true;
+	}
+	if (engine==VERIFY_BATCH){
+		if (batch_step==NULL){
+			batch_step = clCreateKernel(program, "step_batch", &ret);
+		}
+		char *interior = malloc(cells);
+		copyInterior((char *)start, interior, false);
+		cl_uint rule = LIFE_RULE;
+		cl_mem state[2];
+		state[0] = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, cells, interior, &ret);
+		state[1] = clCreateBuffer(context, CL_MEM_READ_WRITE, cells, NULL, &ret);
+		cl_mem rules = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, sizeof(rule), &rule, &ret);
+		size_t local[3]; size_t global[3];
+		setupBatchStep(batch_step, width, height, rules, NULL, 1, local, global);
+		int current=0;
+		for (int g=0;g<run_generations;g++){
+			clSetKernelArg(batch_step, 0, sizeof(cl_mem), &state[current]);
+			clSetKernelArg(batch_step, 1, sizeof(cl_mem), &state[1-current]);
+			ret = clEnqueueNDRangeKernel(command_queue, batch_step, 3, NULL, global, local, 0, NULL, NULL);
+			current=1-current;
+		}
+		clEnqueueReadBuffer(command_queue, state[current], CL_TRUE, 0, cells, interior, 0, NULL, NULL);
+		memcpy(out, start, game_pixels);
+		copyInterior(out, interior, true);
+		clReleaseMemObject(state[0]); clReleaseMemObject(state[1]); clReleaseMemObject(rules);
+		free(interior);
+		return true;
+	}
+	if (engine==VERIFY_HOST){
+		char *grid[2] = {malloc(cells), malloc(cells)};
+		copyInterior((char *)start, grid[0], false);
+		for (int g=0;g<run_generations;g++){
+			stepGrid(grid[g&1], grid[1-(g&1)], width, height);
+		}
+		memcpy(out, start, game_pixels);
+		copyInterior(out, grid[run_generations&1], true);
+		free(grid[0]); free(grid[1]);
+		return true;
+	}
+	if ((engine==VERIFY_IMAGE && !image_available) || (engine==VERIFY_TILED && !tiled_available)){
+		return false;
+	}
+	image_engine = engine==VERIFY_IMAGE; tiled_engine = engine==VERIFY_TILED;
+	setHeatmap(engine==VERIFY_HEATMAP);
+	ret = clEnqueueWriteBuffer(command_queue, game_state, CL_TRUE, 0, game_pixels, start, 0, NULL, NULL);
+	engine_stale=true; board_behind=false;
+	for (int g=0;g<run_generations;g++){
+		enqueueGeneration();
+	}
+	syncBoard();
+	ret = clEnqueueReadBuffer(command_queue, game_state, CL_TRUE, 0, game_pixels, out, 0, NULL, NULL);
+	return true;
+}
+
+//Returns the number of mismatches
+int runVerify(){
+	int slabs_requested = num_slabs; num_slabs=0; //Slabs only run as one of the engines under test
+	selectDevice();
+	gl_sharing=false;
+	cl_context_properties properties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties)platform_id, 0};
+	context = clCreateContext(properties, 1, &device_id, NULL, NULL, &ret);
+	printf("Context return: %i\n", ret);
+	clInit();
+	game_width = board_option_set?board_option_width:256; game_height = board_option_set?board_option_height:256;
+	image_engine=true; tiled_engine=true; //Set both up, so each can be switched on for its own run
+	boardInit();
+	bool image_available = image_engine; bool tiled_available = tiled_engine;
+	image_engine=false; tiled_engine=false;
+	setupLaunchShapes();
+
+	int num_cases = 1+sizeof(verify_patterns)/sizeof(verify_patterns[0]);
+	char *start = malloc(game_pixels); char *expected = malloc(game_pixels); char *result = malloc(game_pixels);
+	int failures=0;
+	for (int c=0;c<num_cases;c++){
+		ret = enqueueBoardKernel(LAUNCH_INITIALIZE_STATE, NULL);
+		if (c==0){
+			ret = enqueueFillRandom(0, 0, game_width, game_height, 0);
+		}
+		ret = clEnqueueReadBuffer(command_queue, game_state, CL_TRUE, 0, game_pixels, start, 0, NULL, NULL);
+		if (c>0){
+			placePattern(start, &verify_patterns[c-1]);
+		}
+		const char *name = c==0?"soup":verify_patterns[c-1].name;
+		runVerifyEngine(VERIFY_BUFFER, start, expected, image_available, tiled_available, &slabs_requested);
+		unsigned long long expected_hash = hashBytes(0xcbf29ce484222325ULL, expected, game_pixels);
+		long population=0;
+		for (size_t i=0;i<game_pixels;i++){
+			population += expected[i]==1;
+		}
+		printf("%s: generation %i, population %li, hash %016llx\n", name, run_generations, population, expected_hash);
+		for (int e=VERIFY_BUFFER+1;e<VERIFY_ENGINES;e++){
+			if (!runVerifyEngine(e, start, result, image_available, tiled_available, &slabs_requested)){
+				printf("  %-15s skipped\n", verify_engine_names[e]);
+				continue;
+			}
+			unsigned long long hash = hashBytes(0xcbf29ce484222325ULL, result, game_pixels);
+			if (hash==expected_hash){
+				printf("  %-15s ok\n", verify_engine_names[e]);
+				continue;
+			}
+			size_t i=0;
+			while (i<game_pixels && result[i]==expected[i]){
+				i++;
+			}
+			printf("  %-15s MISMATCH, hash %016llx, first difference at (%zu, %zu): %i instead of %i\n", verify_engine_names[e], hash,
+				i%game_width, i/game_width, result[i], expected[i]);
+			failures++;
+		}
+	}
+	printf("%s: %i mismatches\n", failures==0?"PASS":"FAIL", failures);
+	free(start); free(expected); free(result);
+	return failures;
+}
+
+//Draws the board texture and waits for it, as a frame would
+void benchDraw(){
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	glFinish();
+	glfwPollEvents();
+}
+
+void runBenchPresent(){
+	glInit();
+	profiling_enabled=true; //For a queue with profiling; the events below are timed directly, so it goes off again
+	clInit();
+	profiling_enabled=false;
+	boardInit();
+	if (!gl_sharing){
+		uploadInit();
+	}
+	setupLaunchShapes();
+	if (writeStateToPixels==NULL){ //Only created when the texture is not shared
+		writeStateToPixels = clCreateKernel(program, "write_state_to_pixels", &ret);
+	}
+	bool sharing = gl_sharing;
+	GLint max_texture=0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture);
+	printf("Presentation paths, %i frames per board size, times in ms as p50/p99%s\n", BENCH_FRAMES, sharing?"":" (no GL sharing, interop skipped)");
+	float acquire_ms[BENCH_FRAMES]; float write_ms[BENCH_FRAMES]; float release_ms[BENCH_FRAMES]; float readback_ms[BENCH_FRAMES]; float transfer_ms[BENCH_FRAMES]; float frame_ms[BENCH_FRAMES];
+	for (int s=0;s<num_bench_sizes;s++){
+		int size = bench_sizes[s];
+		if (size<=2*BORDER_WIDTH || size>max_texture){
+			printf("%ix%i: skipped (texture limit %i)\n", size, size, max_texture);
+			continue;
+		}
+		resizeBoard(size, size);
+		if (game_width!=size || game_height!=size){
+			continue;
+		}
+		enqueueFillRandom(0, 0, game_width, game_height, 0);
+		clFinish(command_queue);
+		double cells = (double)game_pixels;
+		printf("%ix%i (%.1f MB of texture):\n", size, size, cells*4/1048576);
+
+		if (sharing){
+			for (int f=0;f<BENCH_FRAMES;f++){
+				cl_event events[3]={NULL, NULL, NULL}; //A failed enqueue leaves its event NULL
+				double start = monotonicSeconds();
+				ret = clEnqueueAcquireGLObjects(command_queue, 1, &CL_board_texture, 0, NULL, &events[0]);
+				ret = enqueueBoardKernel(LAUNCH_WRITE_STATE, &events[1]);
+				ret = clEnqueueReleaseGLObjects(command_queue, 1, &CL_board_texture, 0, NULL, &events[2]);
+				clFinish(command_queue);
+				transfer_ms[f] = (monotonicSeconds()-start)*1000;
+				benchDraw();
+				frame_ms[f] = (monotonicSeconds()-start)*1000;
+				acquire_ms[f] = eventSeconds(events[0])*1000; write_ms[f] = eventSeconds(events[1])*1000; release_ms[f] = eventSeconds(events[2])*1000;
+				for (int e=0;e<3;e++){
+					if (events[e]!=NULL){
+						clReleaseEvent(events[e]);
+					}
+				}
+			}
+			printf("  interop  acquire %.3f/%.3f  write_state_to_image %.3f/%.3f (%.2f Gcell/s)  release %.3f/%.3f  to texture %.3f/%.3f  frame %.3f/%.3f\n",
+				percentile(acquire_ms, BENCH_FRAMES, 50), percentile(acquire_ms, BENCH_FRAMES, 99), percentile(write_ms, BENCH_FRAMES, 50), percentile(write_ms, BENCH_FRAMES, 99),
+				cells/percentile(write_ms, BENCH_FRAMES, 50)*1e-6, percentile(release_ms, BENCH_FRAMES, 50), percentile(release_ms, BENCH_FRAMES, 99),
+				percentile(transfer_ms, BENCH_FRAMES, 50), percentile(transfer_ms, BENCH_FRAMES, 99), percentile(frame_ms, BENCH_FRAMES, 50), percentile(frame_ms, BENCH_FRAMES, 99));
+		}
+
+		//The copy paths colour into buffers instead, so they run as if the texture were not shared
+		gl_sharing=false;
+		clSetKernelArg(writeStateToPixels, 0, sizeof(game_state), &game_state);
+		clSetKernelArg(writeStateToPixels, 2, sizeof(game_width), &game_width);
+		clSetKernelArg(writeStateToPixels, 3, sizeof(game_height), &game_height);
+		setHeatmap(false);
+		if (sharing){
+			uploadInit();
+		}
+		for (int f=0;f<BENCH_FRAMES;f++){
+			double start = monotonicSeconds();
+			uploadBoard();
+			transfer_ms[f] = (monotonicSeconds()-start)*1000;
+			benchDraw();
+			frame_ms[f] = (monotonicSeconds()-start)*1000;
+		}
+		printf("  pbo      to texture %.3f/%.3f  frame %.3f/%.3f (shows the previous frame's board)\n",
+			percentile(transfer_ms, BENCH_FRAMES, 50), percentile(transfer_ms, BENCH_FRAMES, 99), percentile(frame_ms, BENCH_FRAMES, 50), percentile(frame_ms, BENCH_FRAMES, 99));
+
+		cl_mem pixels = clCreateBuffer(context, CL_MEM_WRITE_ONLY, game_pixels*4, NULL, &ret);
+		unsigned char *host_pixels = malloc(game_pixels*4);
+		clSetKernelArg(writeStateToPixels, 1, sizeof(cl_mem), &pixels);
+		glBindTexture(BOARD_TEXTURE_TYPE, board_texture);
+		for (int f=0;f<BENCH_FRAMES;f++){
+			cl_event events[2]={NULL, NULL};
+			double start = monotonicSeconds();
+			ret = enqueueBoardKernel(LAUNCH_WRITE_STATE, &events[0]);
+			ret = clEnqueueReadBuffer(command_queue, pixels, CL_TRUE, 0, game_pixels*4, host_pixels, 0, NULL, &events[1]);
+			glTexSubImage2D(BOARD_TEXTURE_TYPE, 0, 0, 0, game_width, game_height, GL_RGBA, GL_UNSIGNED_BYTE, host_pixels);
+			transfer_ms[f] = (monotonicSeconds()-start)*1000;
+			benchDraw();
+			frame_ms[f] = (monotonicSeconds()-start)*1000;
+			write_ms[f] = eventSeconds(events[0])*1000; readback_ms[f] = eventSeconds(events[1])*1000;
+			for (int e=0;e<2;e++){
+				if (events[e]!=NULL){
+					clReleaseEvent(events[e]);
+				}
+			}
+		}
+		printf("  host     write_state_to_pixels %.3f/%.3f (%.2f Gcell/s)  read back %.3f/%.3f (%.2f GB/s)  to texture %.3f/%.3f  frame %.3f/%.3f\n",
+			percentile(write_ms, BENCH_FRAMES, 50), percentile(write_ms, BENCH_FRAMES, 99), cells/percentile(write_ms, BENCH_FRAMES, 50)*1e-6,
+			percentile(readback_ms, BENCH_FRAMES, 50), percentile(readback_ms, BENCH_FRAMES, 99), cells*4/percentile(readback_ms, BENCH_FRAMES, 50)*1e-6,
+			percentile(transfer_ms, BENCH_FRAMES, 50), percentile(transfer_ms, BENCH_FRAMES, 99), percentile(frame_ms, BENCH_FRAMES, 50), percentile(frame_ms, BENCH_FRAMES, 99));
+		clReleaseMemObject(pixels);
+		free(host_pixels);
+
+		if (sharing){ //Back to the shared texture, which the next resize expects
+			uploadFree();
+			clFinish(command_queue);
+			gl_sharing=true;
+		}
+	}
+}
 
-int main(){
+int main(int argc, char **argv){
+	parseArguments(argc, argv);
+	if (list_devices){
+		listDevices();
+		return 0;
+	}
+	if (num_ranks>0){
+		runDistributed();
+		return 0;
+	}
+	if (headless){
+		runHeadless();
+		return 0;
+	}
+	if (replay_path!=NULL){
+		runReplay();
+		return 0;
+	}
+	if (search_soups>0){
+		runSearch();
+		return 0;
+	}
+	if (ensemble){
+		runEnsemble();
+		return 0;
+	}
+	if (verify){
+		return runVerify()>0;
+	}
+	if (bench_present){
+		runBenchPresent();
+		return 0;
+	}
 	glInit();
 	clInit();
+	glSyncInit();
 
 	//printf("Hi!\n");
 	// int view_x=0; //Coordinates of the top left corner on the game board
@@ -387,77 +4078,52 @@ int main(){
 
 	
 
-	size_t game_pixels = game_width * game_height;
-	game_state = clCreateBuffer(context, CL_MEM_READ_WRITE, game_pixels, NULL, &ret);
-	printf("Game state buffer creation: %i\n", ret);
-	adjacencies = clCreateBuffer(context, CL_MEM_READ_WRITE, game_pixels, NULL, &ret);
-	printf("Adjacencies buffer creation: %i\n", ret);
-
-	int border_width = BORDER_WIDTH;
-	printf("\n");
-	//Set up arguments for initializeState kernel
-	ret = clSetKernelArg(initializeState, 0, sizeof(game_state), &game_state);// Maybe (void *)&game_state, and likewise for other memory objects
-	printf("Kernel setup 0 return: %i\n", ret);
-	ret = clSetKernelArg(initializeState, 1, sizeof(border_width), &border_width);
-	printf("Kernel setup 1 return: %i\n", ret);
-	ret = clSetKernelArg(initializeState, 2, sizeof(game_width), &game_width);
-	printf("Kernel setup 2 return: %i\n", ret);
-	ret = clSetKernelArg(initializeState, 3, sizeof(game_height), &game_height);
-	printf("Kernel setup 3 return: %i\n", ret);
-
-	//Set up arguments for writeStateToImage kernel
-	ret = clSetKernelArg(writeStateToImage, 0, sizeof(game_state), &game_state);
-	printf("Kernel setup 0 return: %i\n", ret);
-	ret = clSetKernelArg(writeStateToImage, 1, sizeof(CL_board_texture), &CL_board_texture);
-	printf("Kernel setup 1 return: %i\n", ret);
-	ret = clSetKernelArg(writeStateToImage, 2, sizeof(game_width), &game_width);
-	printf("Kernel setup 2 return: %i\n", ret);
-
-	//Set up arguments for computeAdjacencies kernel
-	ret = clSetKernelArg(calculateAdjacencies, 0, sizeof(game_state), &game_state);
-	printf("Kernel setup 0 return: %i\n", ret);
-	ret = clSetKernelArg(calculateAdjacencies, 1, sizeof(adjacencies), &adjacencies);
-	printf("Kernel setup 1 return: %i\n", ret);
-	ret = clSetKernelArg(calculateAdjacencies, 2, sizeof(border_width), &border_width);
-	printf("Kernel setup 2 return: %i\n", ret);
-	ret = clSetKernelArg(calculateAdjacencies, 3, sizeof(game_width), &game_width);
-	printf("Kernel setup 3 return: %i\n", ret);
-
-	//Set up arguments for computeState kernel
-	ret = clSetKernelArg(updateState, 0, sizeof(adjacencies), &adjacencies);
-	printf("Kernel setup 0 return: %i\n", ret);
-	ret = clSetKernelArg(updateState, 1, sizeof(game_state), &game_state);
-	printf("Kernel setup 1 return: %i\n", ret);
-
-	//Set up arguments for flipSquare kernel
-	ret = clSetKernelArg(flipSquare, 0, sizeof(game_state), &game_state);
-	printf("Kernel setup 0 return: %i\n", ret);
-	ret = clSetKernelArg(flipSquare, 3, sizeof(game_width), &game_width);
-	printf("Kernel setup 3 return: %i\n", ret);
-
-	//Set up arguments for zeroAdjacencies kernel
-	ret = clSetKernelArg(zeroAdjacencies, 0, sizeof(adjacencies), &adjacencies);
-	printf("Kernel setup 0 return: %i\n", ret);
-
-	size_t work_group_size = 256; //Batch size
+	boardInit();
+	if (!gl_sharing){
+		uploadInit();
+		clSetKernelArg(writeStateToPixels, 1, sizeof(cl_mem), &upload_pixels[0]);
+	}
+	setupLaunchShapes();
 
 
 	glFinish();
 
-	ret = clEnqueueAcquireGLObjects(command_queue, 1, &CL_board_texture, 0, NULL, NULL);
-	clFinish(command_queue);
-	printf("Acquire return: %i\n",ret);
-	ret = clEnqueueNDRangeKernel(command_queue, initializeState, 1, NULL, &game_pixels, &work_group_size, 0, NULL, NULL);
-	printf("Initialize state return: %i\n",ret);
-	ret = clEnqueueNDRangeKernel(command_queue, writeStateToImage, 1, NULL, &game_pixels, &work_group_size, 0, NULL, NULL);
-	printf("Write state return: %i\n",ret);
-	ret = clEnqueueReleaseGLObjects(command_queue, 1, &CL_board_texture, 0, NULL, NULL);
+	if (gl_sharing){
+		ret = clEnqueueAcquireGLObjects(command_queue, 1, &CL_board_texture, 0, NULL, NULL);
+		clFinish(command_queue);
+		printf("Acquire return: %i\n",ret);
+		ret = enqueueBoardKernel(LAUNCH_INITIALIZE_STATE, NULL);
+		printf("Initialize state return: %i\n",ret);
+		ret = enqueueBoardKernel(LAUNCH_WRITE_STATE, NULL);
+		printf("Write state return: %i\n",ret);
+		ret = clEnqueueReleaseGLObjects(command_queue, 1, &CL_board_texture, 0, NULL, NULL);
+	}
+	else{
+		ret = enqueueBoardKernel(LAUNCH_INITIALIZE_STATE, NULL);
+		printf("Initialize state return: %i\n",ret);
+		uploadBoard();
+	}
 	clFinish(command_queue);
 
 	glfwSwapBuffers(window);
 
+	if (num_slabs>0){
+		slabInit();
+		slabClear();
+	}
+	historyInit();
+	historyRecord();
 
 	bool paused=false;
+	bool board_changed;
+	//While paused with nothing changing, the loop is idle: it skips the board upload and the draw and sleeps in
+	//glfwWaitEventsTimeout until input arrives. Each change schedules redraw_frames draws first (two on the upload
+	//path, whose display lags by a frame).
+	bool idle=false;
+	int redraw_frames=UPLOAD_BUFFERS;
+	int old_screen_width=0; int old_screen_height=0;
+	cl_event board_released=NULL; //Release of the board texture this frame, for GL_ARB_cl_event
+	cl_event gl_drawn=NULL; GLsync gl_drawn_fence=NULL; //Fence after the previous draw, for cl_khr_gl_event
 	double temp_cursor_x; double temp_cursor_y;
 	int cursor_x; int cursor_y;
 	int square_x; int square_y;
@@ -465,13 +4131,24 @@ int main(){
 	int prev_square_x; int prev_square_y;
 
 
-	clock_t t=clock();
-	clock_t frame_clock=clock();
-	clock_t refresh_clock=clock();
-	clock_t screenshift_clock=clock();
+	double t=glfwGetTime();
+	double pace_time=monotonicSeconds();
+	double generation_accumulator=0; //Simulated time not yet turned into generations
+	int frame_generations=0;
+	double next_refresh=pace_time;
+	double last_draw=pace_time;
+	int draw_generations=0; //Generations since the last draw
+	bool draw_due=false;
+	double render_start=pace_time;
+	double screenshift_time=pace_time;
 	
 	float refresh_rate = 144.0f; //Sets frame rate
 	float game_frame_rate = 144.0f; //Sets game frame rate
+	const GLFWvidmode *video_mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+	if (vsync && video_mode!=NULL){
+		refresh_rate = video_mode->refreshRate;
+	}
+	glfwSwapInterval(vsync?1:0);
 	bool space_pressed = false;
 	GLfloat camera_pos[2]={0.0,0.0};
 	int zoom=1;
@@ -481,6 +4158,10 @@ int main(){
 	const size_t one[1]={1};//For flipping single pixels
 
 	glfwSetScrollCallback(window, scroll_callback); //This should maintain rawScroll as up-to-date
+	glfwSetWindowRefreshCallback(window, refresh_callback);
+	if (capture_path!=NULL){
+		captureInit(refresh_rate);
+	}
 
 	GLint camera_pos_shader_loc = glGetUniformLocation(shaderProgram, "cameraPos");
 	GLint zoom_shader_loc = glGetUniformLocation(shaderProgram, "zoom");
@@ -491,36 +4172,49 @@ int main(){
 
 	glEnable(GL_DEBUG_OUTPUT);
 	bool speed_adjust_pressed=false;
+	bool fill_pressed=false;
+	bool heatmap_pressed=false;
+	bool resize_pressed=false;
+	double resize_time=0; //When the window last changed size, while a --resize-with-window resize is pending
+	double profile_overlay_time=glfwGetTime();
+	metrics.report_time=glfwGetTime();
 
 	while (glfwWindowShouldClose(window) == false){
-		//printf("Clocks per second: %li\n", CLOCKS_PER_SEC);
-		printf("Frame time: %li, FPS: %f\n", clock()-t, CLOCKS_PER_SEC/((float)clock()-t));
-		t=clock();
+		double now=glfwGetTime();
+		board_changed=false;
+		if (!idle){ //The time spent waiting for events is not a frame
+			recordFrame((now-t)*1000.0f, frame_generations);
+		}
+		t=now;
+		if (stats_interval>0 && now-metrics.report_time>=stats_interval){
+			reportMetrics(now, game_frame_rate, paused);
+		}
 		if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS){
 			glfwSetWindowShouldClose(window, true);
 		}
 		if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS && !space_pressed){
 			space_pressed=true;
 			paused=!paused;
-			printf("Paused: %i\n", paused);
 		}
 		if (glfwGetKey(window, GLFW_KEY_SPACE) != GLFW_PRESS){
 			space_pressed=false;
 		}
 
+		float shift = monotonicSeconds()-screenshift_time;
+		shift = (shift>0.1f?0.1f:shift)*500.0f/(float)zoom; //Capped so a key pressed after an idle wait does not jump
 		if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS){
-			camera_pos[0]-=(clock()-screenshift_clock)*500.0f/CLOCKS_PER_SEC/(float)zoom;
+			camera_pos[0]-=shift;
 		}
 		if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS){
-			camera_pos[0]+=(clock()-screenshift_clock)*500.0f/CLOCKS_PER_SEC/(float)zoom;
+			camera_pos[0]+=shift;
 		}
 		if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS){
-			camera_pos[1]+=(clock()-screenshift_clock)*500.0f/CLOCKS_PER_SEC/(float)zoom;
+			camera_pos[1]+=shift;
 		}
 		if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS){
-			camera_pos[1]-=(clock()-screenshift_clock)*500.0f/CLOCKS_PER_SEC/(float)zoom;
+			camera_pos[1]-=shift;
 		}
-		screenshift_clock=clock();
+		screenshift_time=monotonicSeconds();
 
 		if (glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS && !speed_adjust_pressed){
 			game_frame_rate/=1.5f;
@@ -533,7 +4227,6 @@ int main(){
 		if (glfwGetKey(window, GLFW_KEY_EQUAL) != GLFW_PRESS && glfwGetKey(window, GLFW_KEY_MINUS) != GLFW_PRESS){
 			speed_adjust_pressed=false;
 		}
-		printf("Game frame rate: %f\n", game_frame_rate);
 		if (game_frame_rate<1){
 			game_frame_rate=1;
 		}
@@ -543,9 +4236,47 @@ int main(){
 
 
 		if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS){
-			ret = clEnqueueNDRangeKernel(command_queue, initializeState, 1, NULL, &game_pixels, &work_group_size, 0, NULL, NULL);
+			if (num_slabs>0){
+				slabClear();
+			}
+			else{
+				ret = enqueueBoardKernel(LAUNCH_INITIALIZE_STATE, profileEvent(PROFILE_INITIALIZE_STATE));
+				engine_stale=true;
+			}
+			board_changed=true;
+		}
+		if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS){ //Held down, these rewind or replay one entry per frame
+			paused=true;
+			historyFlush(); //The record in flight is the newest entry
+			historyRestore(history_cursor-1);
+			redraw_frames=UPLOAD_BUFFERS;
+		}
+		if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS){
+			paused=true;
+			historyFlush();
+			historyRestore(history_cursor+1);
+			redraw_frames=UPLOAD_BUFFERS;
 		}
 		glfwGetWindowSize(window, &current_screen_width, &current_screen_height);
+		if (current_screen_width!=old_screen_width || current_screen_height!=old_screen_height){
+			old_screen_width=current_screen_width; old_screen_height=current_screen_height;
+			redraw_frames=UPLOAD_BUFFERS;
+			resize_time=resize_with_window?monotonicSeconds():0;
+		}
+		bool resize_requested = glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS && !resize_pressed;
+		resize_pressed = glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS;
+		if (resize_time>0 && monotonicSeconds()-resize_time>=RESIZE_SETTLE){ //Wait for the drag to end
+			resize_requested=true;
+			resize_time=0;
+		}
+		if (resize_requested && resizeBoard(current_screen_width, current_screen_height)){
+			int framebuffer_width; int framebuffer_height;
+			glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+			glViewport(0, 0, framebuffer_width, framebuffer_height);
+			camera_pos[0]=0; camera_pos[1]=0;
+			board_changed=true;
+			redraw_frames=UPLOAD_BUFFERS;
+		}
 		glfwGetCursorPos(window, &temp_cursor_x, &temp_cursor_y);
 		cursor_x=temp_cursor_x; cursor_y=temp_cursor_y;
 
@@ -556,29 +4287,43 @@ int main(){
 			if (prev_square_x != square_x || prev_square_y != square_y){
 				prev_square_x=square_x; prev_square_y=square_y;
 				if (square_x>=0 && square_x<game_width && square_y>=0 && square_y<game_height){
-					ret = clSetKernelArg(flipSquare, 1, sizeof(square_x), &square_x);//May not need to do this every time, but I think I do.
-					ret = clSetKernelArg(flipSquare, 2, sizeof(square_y), &square_y);
-					ret = clEnqueueNDRangeKernel(command_queue, flipSquare, 1, NULL, one, one, 0, NULL, NULL);
+					if (num_slabs>0){
+						slabFlip(square_x, square_y);
+					}
+					else{
+						syncBoard();
+						ret = clSetKernelArg(flipSquare, 1, sizeof(square_x), &square_x);//May not need to do this every time, but I think I do.
+						ret = clSetKernelArg(flipSquare, 2, sizeof(square_y), &square_y);
+						ret = clEnqueueNDRangeKernel(command_queue, flipSquare, 1, NULL, one, one, 0, NULL, profileEvent(PROFILE_FLIP_SQUARE));
+						engine_stale=true;
+					}
+					board_changed=true;
 				}
 				//printf("Flip square enqueue: %i\n", ret);
 			}
 		}
-		if ((glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT)==GLFW_PRESS)){ //Randomly flip squares around the cursor
+		if ((glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT)==GLFW_PRESS)){ //Randomize the squares around the cursor
 			corner_x=camera_pos[0]/2-((float)game_width)/2/zoom+((float)game_width)/2; corner_y=-camera_pos[1]/2-((float)current_screen_height*2-game_height)/2/zoom+((float)game_height)/2;
 			square_x=corner_x+((float)cursor_x)/zoom; square_y=corner_y+((float)cursor_y)/zoom;
-			int off_square_x; int off_square_y;
-			for (int i=-5;i<=5;i++){
-				for (int j=-5;j<=5;j++){
-					off_square_x=square_x+i; off_square_y=square_y+j;
-					if (off_square_x>=0 && off_square_x<game_width && off_square_y>=0 && off_square_y<game_height && rand()%2==1){
-						ret = clSetKernelArg(flipSquare, 1, sizeof(off_square_x), &off_square_x);//May not need to do this every time, but I think I do.
-						ret = clSetKernelArg(flipSquare, 2, sizeof(off_square_y), &off_square_y);
-						ret = clEnqueueNDRangeKernel(command_queue, flipSquare, 1, NULL, one, one, 0, NULL, NULL);
-					}
-				}
+			if (num_slabs>0){ //Slabs keep their own buffers
+				slabFillRandom(square_x-5, square_y-5, 11, 11, soup_stream);
 			}
-
+			else{
+				ret = enqueueFillRandom(square_x-5, square_y-5, 11, 11, soup_stream);
+			}
+			soup_stream++;
+			board_changed=true;
+		}
+		if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS && !fill_pressed && num_slabs==0){ //Randomize the whole board
+			ret = enqueueFillRandom(0, 0, game_width, game_height, soup_stream++);
+			board_changed=true;
 		}
+		fill_pressed = glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS;
+		if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS && !heatmap_pressed){
+			setHeatmap(!heatmap);
+			redraw_frames=UPLOAD_BUFFERS;
+		}
+		heatmap_pressed = glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS;
 		if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT)!=GLFW_PRESS){
 			prev_square_x = -1; prev_square_y = -1;
 		}
@@ -612,65 +4357,189 @@ int main(){
 
 
 
-		glFinish();
+		if (!gl_event_sync){
+			glFinish();
+		}
 		//printf("Time pre-uniform: %li\n", clock()-t);
 		//glUseProgram(shaderProgram); //Probably not needed
 		if (zoom!=old_zoom){
 			glUniform1i(zoom_shader_loc,zoom);
 			old_zoom=zoom;
+			redraw_frames=UPLOAD_BUFFERS;
 		}
 		if (camera_pos[0]!=old_camera_pos[0] || camera_pos[1]!=old_camera_pos[1]){
 			glUniform2fv(camera_pos_shader_loc,1,camera_pos);
 			old_camera_pos[0]=camera_pos[0]; old_camera_pos[1]=camera_pos[1];
+			redraw_frames=UPLOAD_BUFFERS;
+		}
+		if (board_changed || window_damaged){
+			redraw_frames=UPLOAD_BUFFERS;
+			window_damaged=false;
+		}
+		idle = paused && redraw_frames==0 && capture_path==NULL && resize_time==0;
+		if (!gl_event_sync){
+			glFinish();
 		}
-		glFinish();
 		//printf("Time pre-acquire: %li\n", clock()-t);
-		//Acquire the board image. Then update the board state if needed, and write it to the image
-		ret = clEnqueueAcquireGLObjects(command_queue, 1, &CL_board_texture, 0, NULL, NULL);
-		//printf("%li\n",(clock()-t)/CLOCKS_PER_SEC);
-		if ((!paused)){
-			//printf("Time pre-adjacencies: %li\n", clock()-t);
-			ret = clEnqueueNDRangeKernel(command_queue, zeroAdjacencies, 1, NULL, &game_pixels, &work_group_size, 0, NULL, NULL);
-			int offset;
-			for (int i=-1;i<=1;i++){
-				for (int j=-1;j<=1;j++){
-					if (i!=0 || j!=0){
-						offset = i*game_width+j;
-						ret = clSetKernelArg(calculateAdjacencies, 4, sizeof(offset), &offset);
-						ret = clEnqueueNDRangeKernel(command_queue, calculateAdjacencies, 1, NULL, &game_pixels, &work_group_size, 0, NULL, NULL);
-					}
+		if (!idle){
+			//printf("%li\n",(clock()-t)/CLOCKS_PER_SEC);
+			double pace_now = monotonicSeconds();
+			generation_accumulator = paused?0:generation_accumulator+pace_now-pace_time;
+			generation_accumulator = generation_accumulator>PACING_MAX_LAG?PACING_MAX_LAG:generation_accumulator;
+			pace_time = pace_now;
+			collectSimCost();
+			frame_generations = (int)(generation_accumulator*game_frame_rate);
+			if (sim_cost>0 && frame_generations>(int)(max_frame_latency/sim_cost)+1){ //The rest stays in the accumulator
+				frame_generations = (int)(max_frame_latency/sim_cost)+1;
+			}
+			generation_accumulator -= frame_generations/game_frame_rate;
+			//Slabs step in lockstep through their halos, so the first slab's queue stands for all of them
+			cl_command_queue sim_queue = num_slabs>0?slabs[0].compute_queue:command_queue;
+			bool timed = frame_generations>0 && sim_timing_generations==0;
+			if (timed){ //The generations start once the work queued before them is done
+				enqueueSimMarker(sim_queue, &sim_timing_start);
+			}
+			for (int g=0;g<frame_generations;g++){
+				if (num_slabs>0){
+					slabStep();
+				}
+				else{
+					enqueueGeneration();
+				}
+			}
+			if (timed){
+				enqueueSimMarker(sim_queue, &sim_timing_end);
+				clFlush(sim_queue);
+				sim_timing_generations=frame_generations;
+			}
+			board_generation+=frame_generations;
+			board_changed|=frame_generations>0;
+			if (board_changed){
+				historyRecord();
+			}
+			draw_generations+=frame_generations;
+			draw_due = monotonicSeconds()>=next_refresh;
+			if (draw_due){
+				syncBoard();
+			}
+			//Acquire the board image and write the state to it, only for a frame that will be drawn
+			render_start = monotonicSeconds();
+			if (draw_due && gl_sharing){
+				if (gl_drawn!=NULL){ //Last frame's fence may only go once the acquire that waited on it is done
+					clWaitForEvents(1, &gl_drawn);
+					clReleaseEvent(gl_drawn);
+					glDeleteSync(gl_drawn_fence);
+					gl_drawn=NULL;
+				}
+				if (gl_event_sync){ //The acquire waits on a fence after the last draw instead of a glFinish
+					gl_drawn_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+					glFlush();
+					gl_drawn = createEventFromGLsync(context, (cl_GLsync)gl_drawn_fence, &ret);
+				}
+				ret = clEnqueueAcquireGLObjects(command_queue, 1, &CL_board_texture, gl_drawn!=NULL, gl_drawn!=NULL?&gl_drawn:NULL, profileEvent(PROFILE_GL_ACQUIRE));
+				ret = enqueueBoardKernel(LAUNCH_WRITE_STATE, profileEvent(PROFILE_WRITE_STATE_TO_IMAGE));
+				cl_event *release_event = profileEvent(PROFILE_GL_RELEASE);
+				if (release_event==NULL && gl_event_sync && createSyncFromCLevent!=NULL){
+					release_event = &board_released;
+				}
+				ret = clEnqueueReleaseGLObjects(command_queue, 1, &CL_board_texture, 0, NULL, release_event);
+			}
+			else if (draw_due){
+				uploadBoard();
+			}
+			if (gl_event_sync && !profiling_enabled){ //Profiling reads the events back, so it still needs them finished
+				ret = clFlush(command_queue);
+			}
+			else{
+				ret = clFinish(command_queue);
+			}
+			if (profiling_enabled){
+				collectProfileEvents();
+				if (glfwGetTime()-profile_overlay_time>0.5){
+					updateProfileOverlay();
+					profile_overlay_time=glfwGetTime();
 				}
 			}
-			ret = clFinish(command_queue);
-			//printf("Time post-adjacencies: %li\n", clock()-t);
-			ret = clEnqueueNDRangeKernel(command_queue, updateState, 1, NULL, &game_pixels, &work_group_size, 0, NULL, NULL);
 		}
-		ret = clEnqueueNDRangeKernel(command_queue, writeStateToImage, 1, NULL, &game_pixels, &work_group_size, 0, NULL, NULL);
-		ret = clEnqueueReleaseGLObjects(command_queue, 1, &CL_board_texture, 0, NULL, NULL);
-		ret = clFinish(command_queue);
 		//printf("Time post-release: %li\n", clock()-t);
 
 
 		// view_center_x = view_x + current_screen_width; view_center_x = view_y + current_screen_height;
 
 	
-		if (((float)clock()-refresh_clock)/CLOCKS_PER_SEC>1.0f/refresh_rate){ // Change for different displays
+		if (!idle && draw_due){
+			if (board_released!=NULL){ //The GPU waits for the release; the CPU goes on. The capture reads the texture too.
+				GLsync released = createSyncFromCLevent(context, board_released, 0);
+				glWaitSync(released, 0, GL_TIMEOUT_IGNORED);
+				glDeleteSync(released);
+			}
+			if (capture_path!=NULL){
+				captureBoard();
+			}
 			glClearColor(0, 0, 0, 255);
 			glClear(GL_COLOR_BUFFER_BIT);
 			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-			glFinish();
+			if (!gl_event_sync){
+				glFinish();
+			}
 			//printf("Time post-draw: %li\n", clock()-t);
 			glfwSwapBuffers(window);
-			refresh_clock=clock();
+			double drawn = monotonicSeconds();
+			double sample = drawn-render_start;
+			render_cost = render_cost==0?sample:render_cost+COST_SMOOTHING*(sample-render_cost);
+			//Draw as often as the time left over from the simulation allows
+			double refresh_period = 1.0/refresh_rate;
+			double load = paused?0:sim_cost*game_frame_rate;
+			double render_interval = load>=1?max_frame_latency:render_cost/(1-load);
+			render_interval = render_interval<refresh_period?refresh_period:render_interval>max_frame_latency?max_frame_latency:render_interval;
+			int skipped = (int)((drawn-last_draw)/refresh_period+0.5)-1;
+			metrics.dropped += skipped>0 && !paused?skipped:0;
+			metrics.draws++;
+			metrics.generations_per_draw = draw_generations;
+			draw_generations = 0;
+			last_draw = drawn;
+			if (vsync){ //Swaps return on the vblank, so aim a little before the one after render_interval
+				next_refresh = drawn+render_interval-PACING_SPIN_TAIL;
+			}
+			else{
+				next_refresh = next_refresh+render_interval<drawn?drawn+render_interval:next_refresh+render_interval;
+			}
+			redraw_frames-=redraw_frames>0;
 		}
-		if (!paused){
-			while (((float)clock()-frame_clock)/CLOCKS_PER_SEC<1.0f/game_frame_rate){};
+		if (board_released!=NULL){
+			clReleaseEvent(board_released);
+			board_released=NULL;
+		}
+		if (!idle){ //Sleep until the next redraw, or the next generation if that comes first
+			double next_generation = pace_time+(1.0/game_frame_rate-generation_accumulator);
+			sleepUntil(paused || next_generation>next_refresh?next_refresh:next_generation);
 		}
 
-		frame_clock=clock();
-		glFinish();
+		if (idle){ //Wakes up for input, or in time for the next stats report
+			glfwWaitEventsTimeout(stats_interval>0?stats_interval:1.0);
+			pace_time=monotonicSeconds(); //A paused wait must not turn into generations on unpause
+			continue;
+		}
+		if (!gl_event_sync){
+			glFinish();
+		}
 		//printf("Time post-swap: %li\n", clock()-t);
 		glfwPollEvents();
-		glFinish();
+		if (!gl_event_sync){
+			glFinish();
+		}
+	}
+	if (capture_path!=NULL){
+		captureFinish();
+	}
+	historyFlush();
+	if (journal_path!=NULL){
+		journalFinish();
+	}
+	if (heatmap_path!=NULL){
+		writeHeatmap(heatmap_path);
+	}
+	if (profiling_enabled){
+		writeProfileCSV(profile_csv_path);
 	}
 }
\ No newline at end of file